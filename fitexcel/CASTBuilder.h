@@ -2,6 +2,7 @@
 
 
 #include <string>
+#include <string_view>
 #include <deque>
 #include "CNode.h"
 #include "expression.h"
@@ -11,117 +12,169 @@
 class CASTBuilder : public CExprBuilder{
 public:
     CASTBuilder() = default;
-    ~CASTBuilder(){
-        for(CNode* n : stack_)
-            delete n;
-    }
     void opAdd() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new AddNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<AddNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opSub() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new SubNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<SubNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opMul() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new MulNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<MulNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opDiv() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new DivNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<DivNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opPow() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new PowNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<PowNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opNeg() override{
-        CNode* node = new NegNode(stack_.front());
+        CNode* node = arena_->make<NegNode>(stack_.front());
         stack_.pop_front();
-        stack_.push_front(node);
+        stack_.push_front(simplify(node));
     }
     void opEq() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new EqNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<EqNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opNe() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new NeNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<NeNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opLt() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new LtNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<LtNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opLe() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new LeNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<LeNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opGt() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new GtNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<GtNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void opGe() override{
         CNode* right = stack_.front();
         stack_.pop_front();
         CNode* left = stack_.front();
         stack_.pop_front();
-        CNode* node = new GeNode(left, right);
-        stack_.push_front(node);
+        CNode* node = arena_->make<GeNode>(left, right);
+        stack_.push_front(simplify(node));
     }
     void valNumber(double val) override{
-        stack_.push_front(new ValNrNode(val));
+        stack_.push_front(arena_->make<ValNrNode>(val));
     }
     void valString(std::string val) override{
-        stack_.push_front(new ValStrNode(val));
+        valString(std::string_view(val));
     }
     void valReference(std::string val) override{
-        stack_.push_front(new ValRefNode(val));
+        stack_.push_front(arena_->make<ValRefNode>(val));
+    }
+    //the parser passes tokens without copying them and references already split into their parts
+    void valString(std::string_view val){
+        stack_.push_front(arena_->make<ValStrNode>(val));
+    }
+    void valReference(int col, int row, bool col_abs, bool row_abs){
+        stack_.push_front(arena_->make<ValRefNode>(col, row, col_abs, row_abs));
     }
     void valRange([[maybe_unused]]std::string val) override{}
 
     void funcCall([[maybe_unused]]std::string fnName, [[maybe_unused]]int paramCount) override{}
 
 
+    //fold a node whose operands are all constants into a single constant, remove operations that do not change
+    //their numeric operand (x+0, 0+x, x-0, x*1, 1*x, x/1, x^1) and replace squares of references by multiplications
+    //the operands are simplified already, since the AST is built bottom-up
+    //nodes left out of the simplified tree stay in the arena until it is released
+    CNode* simplify(CNode* node){
+        if(CNode* folded = fold(node))
+            return folded;
+        BinaryOpNode* bin = dynamic_cast<BinaryOpNode*>(node);
+        if(bin == nullptr)
+            return node;
+        CProgram::COp op = bin->op();
+        const ValNrNode* left = dynamic_cast<const ValNrNode*>(bin->left_);
+        const ValNrNode* right = dynamic_cast<const ValNrNode*>(bin->right_);
+        if(right && bin->left_->numeric() && (((op == CProgram::COp::Add || op == CProgram::COp::Sub) && right->num_ == 0)
+                || ((op == CProgram::COp::Mul || op == CProgram::COp::Div || op == CProgram::COp::Pow) && right->num_ == 1))){
+            return bin->left_;
+        }
+        if(left && bin->right_->numeric() && ((op == CProgram::COp::Add && left->num_ == 0)
+                || (op == CProgram::COp::Mul && left->num_ == 1))){
+            return bin->right_;
+        }
+        if(right && op == CProgram::COp::Pow && right->num_ == 2 && dynamic_cast<const ValRefNode*>(bin->left_)){
+            return arena_->make<MulNode>(bin->left_, bin->left_->clone(*arena_));
+        }
+        return node;
+    }
+
+    //return the constant the node evaluates to if all its operands are constants, nullptr otherwise
+    //results that cannot be written as a literal (empty values, infinities and NaN) are not folded
+    CNode* fold(const CNode* node){
+        if(const BinaryOpNode* bin = dynamic_cast<const BinaryOpNode*>(node)){
+            if(!bin->left_->constant() || !bin->right_->constant())
+                return nullptr;
+        }
+        else if(const UnaryOpNode* un = dynamic_cast<const UnaryOpNode*>(node)){
+            if(!un->child_->constant())
+                return nullptr;
+        }
+        else
+            return nullptr;
+        CConstantEvaluator ev;
+        CValue res = node->evaluate(ev);
+        if(std::holds_alternative<double>(res) && std::isfinite(std::get<double>(res)))
+            return arena_->make<ValNrNode>(std::get<double>(res));
+        if(std::holds_alternative<std::string>(res))
+            return arena_->make<ValStrNode>(std::get<std::string>(res));
+        return nullptr;
+    }
+
     //return root of the last built AST
     //this function is only called after an expression was successfully parsed and an AST has been built
     CNode* getAST() {
@@ -129,6 +182,36 @@ public:
         stack_.pop_front();
         return root;
     }
+
+    //arena owning the nodes of the ASTs built by the builder in the current batch and in the batches before it that
+    //share the arena, it has to be kept alive as long as any of them is used
+    const std::shared_ptr<CArena>& arena() const{
+        return arena_;
+    }
+
+    //start building the trees of a new batch, the batches share one arena until it grows to ARENA_CHUNK bytes and
+    //a new arena is started, so a sheet keeps one arena per chunk of trees instead of one per parse, and an arena is
+    //released once no formula built in it is kept - the nodes of discarded trees are released with their chunk
+    //if no formula keeps the arena, it only held discarded nodes and it is cleared and used again
+    //the trees built before are only valid as long as a formula keeps their arena alive
+    void startBatch(){
+        stack_.clear();
+        if(arena_.use_count() == 1)
+            arena_->clear();
+        else if(arena_->capacity() >= ARENA_CHUNK)
+            arena_ = std::make_shared<CArena>();
+    }
 private:
+    //size of the arena at which the next batch starts a new one, a formula kept alone keeps at most this much memory
+    static constexpr size_t ARENA_CHUNK = 16 * 1024;
+
+    //evaluator for constant expressions, which reference no cells
+    struct CConstantEvaluator : public CEvaluator {
+        CValue valueAt([[maybe_unused]]const CPos& pos) override{
+            return CValue();
+        }
+    };
+
     std::deque<CNode*> stack_;
+    std::shared_ptr<CArena> arena_ = std::make_shared<CArena>();
 };
@@ -0,0 +1,88 @@
+#ifndef CArena_h
+#define CArena_h
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+//bump allocator for objects sharing one lifetime, e.g. the nodes of the trees built by consecutive changes
+//objects are placed one after another into blocks, so creating an object costs no separate allocation
+//and all of them are released at once together with the arena - a single object is never freed on its own
+//the first block is a part of the arena and the blocks grow from it, so an arena holding a single tree is small and
+//allocated at once
+//only types that declare OWNS_MEMORY have their destructors run, the others must not hold any resources
+class CArena {
+public:
+    CArena() = default;
+    CArena(const CArena& src) = delete;
+    CArena& operator =(const CArena& other) = delete;
+    ~CArena(){
+        destroy();
+    }
+
+    template<typename T, typename... Args>
+    T* make(Args&&... args){
+        T* res = new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if constexpr(T::OWNS_MEMORY)
+            destructors_.push_back({res, [](void* object){ static_cast<T*>(object)->~T(); }});
+        return res;
+    }
+
+    //release all objects and blocks, the arena can be used again
+    void clear(){
+        destroy();
+        destructors_.clear();
+        blocks_.clear();
+        block_ = first_block_;
+        block_size_ = MIN_BLOCK_SIZE;
+        capacity_ = MIN_BLOCK_SIZE;
+        used_ = 0;
+    }
+
+    //total size of the blocks allocated by the arena
+    size_t capacity() const{
+        return capacity_;
+    }
+
+private:
+    static constexpr size_t MIN_BLOCK_SIZE = 256;
+    static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+
+    void* allocate(size_t size, size_t align){
+        size_t start = (used_ + align - 1) & ~(align - 1);
+        if(start + size > block_size_){
+            block_size_ = std::max(std::min(2 * block_size_, MAX_BLOCK_SIZE), size + align);
+            blocks_.emplace_back(new std::byte[block_size_]);
+            block_ = blocks_.back().get();
+            capacity_ += block_size_;
+            start = 0;
+        }
+        used_ = start + size;
+        return block_ + start;
+    }
+
+    void destroy(){
+        for(auto it = destructors_.rbegin(); it != destructors_.rend(); ++it)
+            it->destroy(it->object);
+    }
+
+    struct CDestructor {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    alignas(std::max_align_t) std::byte first_block_[MIN_BLOCK_SIZE];
+    std::vector<std::unique_ptr<std::byte[]>> blocks_;
+    //the last block, its size and the number of bytes used in it
+    std::byte* block_ = first_block_;
+    size_t block_size_ = MIN_BLOCK_SIZE;
+    size_t used_ = 0;
+    size_t capacity_ = MIN_BLOCK_SIZE;
+    std::vector<CDestructor> destructors_;
+};
+
+#endif /* CArena_h */
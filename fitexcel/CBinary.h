@@ -0,0 +1,135 @@
+#ifndef CBinary_h
+#define CBinary_h
+
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+
+//writer of the binary save format, integers and doubles are stored in little-endian byte order independently
+//of the machine, strings are stored as their length followed by their bytes
+class CBinaryWriter {
+public:
+    explicit CBinaryWriter(std::string& out) : out_(out) {}
+
+    void putBytes(std::string_view bytes){
+        out_.append(bytes);
+    }
+    void putByte(unsigned char byte){
+        out_.push_back((char)byte);
+    }
+    void putUnsigned(uint32_t value){
+        for(int i = 0; i < 4; ++i)
+            out_.push_back((char)(value >> (8 * i)));
+    }
+    void putInt(int32_t value){
+        putUnsigned((uint32_t)value);
+    }
+    void putUnsigned64(uint64_t value){
+        for(int i = 0; i < 8; ++i)
+            out_.push_back((char)(value >> (8 * i)));
+    }
+    void putDouble(double value){
+        putUnsigned64(std::bit_cast<uint64_t>(value));
+    }
+    void putString(std::string_view str){
+        putUnsigned((uint32_t)str.size());
+        out_.append(str);
+    }
+    //unsigned integer in groups of 7 bits from the lowest one, every byte except the last one has its high bit set
+    void putVarint(uint64_t value){
+        for(; value >= 0x80; value >>= 7)
+            out_.push_back((char)(value | 0x80));
+        out_.push_back((char)value);
+    }
+    //signed integer mapped to an unsigned one by zigzag coding, so a small negative number is short as well
+    void putSignedVarint(int64_t value){
+        putVarint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    }
+
+private:
+    std::string& out_;
+};
+
+
+//reader of the binary save format, reading past the end of the data throws std::invalid_argument
+class CBinaryReader {
+public:
+    explicit CBinaryReader(std::string_view data) : data_(data) {}
+
+    unsigned char getByte(){
+        require(1);
+        return (unsigned char)data_[pos_++];
+    }
+    uint32_t getUnsigned(){
+        require(4);
+        uint32_t value = 0;
+        for(int i = 0; i < 4; ++i)
+            value |= (uint32_t)(unsigned char)data_[pos_++] << (8 * i);
+        return value;
+    }
+    int32_t getInt(){
+        return (int32_t)getUnsigned();
+    }
+    uint64_t getUnsigned64(){
+        require(8);
+        uint64_t value = 0;
+        for(int i = 0; i < 8; ++i)
+            value |= (uint64_t)(unsigned char)data_[pos_++] << (8 * i);
+        return value;
+    }
+    double getDouble(){
+        return std::bit_cast<double>(getUnsigned64());
+    }
+    uint64_t getVarint(){
+        uint64_t value = 0;
+        for(int shift = 0; shift < 64; shift += 7){
+            unsigned char byte = getByte();
+            value |= (uint64_t)(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+                return value;
+        }
+        throw std::invalid_argument("Invalid integer at position " + std::to_string(pos_));
+    }
+    int64_t getSignedVarint(){
+        uint64_t value = getVarint();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+    //the returned views point into the data being read
+    std::string_view getBytes(size_t size){
+        require(size);
+        std::string_view bytes = data_.substr(pos_, size);
+        pos_ += size;
+        return bytes;
+    }
+    std::string_view getString(){
+        return getBytes(getUnsigned());
+    }
+    //read the given bytes, throw if the data contains different ones
+    void expect(std::string_view bytes){
+        require(bytes.size());
+        if(data_.substr(pos_, bytes.size()) != bytes)
+            throw std::invalid_argument("Unexpected data at position " + std::to_string(pos_));
+        pos_ += bytes.size();
+    }
+
+    bool atEnd() const{
+        return pos_ == data_.size();
+    }
+    size_t remaining() const{
+        return data_.size() - pos_;
+    }
+
+private:
+    void require(size_t size) const{
+        if(data_.size() - pos_ < size)
+            throw std::invalid_argument("Unexpected end of data at position " + std::to_string(pos_));
+    }
+
+    std::string_view data_;
+    size_t pos_ = 0;
+};
+
+#endif /* CBinary_h */
@@ -0,0 +1,221 @@
+#include <cmath>
+#include "CASTBuilder.h"
+#include "CBinaryFormat.h"
+
+void CBinaryIndex::serialize(CBinaryWriter& writer) const{
+    auto putSpan = [&writer](const CBlockSpan& span){
+        writer.putUnsigned64(span.offset);
+        writer.putUnsigned64(span.size);
+        writer.putUnsigned(span.first);
+        writer.putUnsigned(span.count);
+    };
+    writer.putUnsigned((uint32_t)formula_blocks.size());
+    for(const CBlockSpan& span : formula_blocks)
+        putSpan(span);
+    writer.putUnsigned64(tiles.size());
+    for(const auto& [key, span] : tiles){
+        writer.putUnsigned64(key);
+        putSpan(span);
+    }
+}
+
+CBinaryIndex CBinaryIndex::deserialize(CBinaryReader& reader){
+    auto getSpan = [&reader]{
+        CBlockSpan span;
+        span.offset = reader.getUnsigned64();
+        span.size = reader.getUnsigned64();
+        span.first = reader.getUnsigned();
+        span.count = reader.getUnsigned();
+        return span;
+    };
+    CBinaryIndex index;
+    uint32_t formula_blocks = reader.getUnsigned();
+    for(uint32_t i = 0; i < formula_blocks; ++i){
+        index.formula_blocks.push_back(getSpan());
+        //the spans cover the formula table in order without gaps
+        uint32_t expected = i == 0 ? 0 : index.formula_blocks[i - 1].first + index.formula_blocks[i - 1].count;
+        if(index.formula_blocks[i].first != expected || index.formula_blocks[i].count == 0)
+            throw std::invalid_argument("Invalid index");
+    }
+    uint64_t tiles = reader.getUnsigned64();
+    for(uint64_t i = 0; i < tiles; ++i){
+        uint64_t key = reader.getUnsigned64();
+        index.tiles.emplace_back(key, getSpan());
+    }
+    return index;
+}
+
+CNode* decodeFormula(CBinaryReader& reader, CASTBuilder& builder, CReferenceRange& range){
+    using COp = CProgram::COp;
+    uint32_t count = reader.getUnsigned();
+    size_t depth = 0;
+    for(uint32_t i = 0; i < count; ++i){
+        COp op = (COp)reader.getByte();
+        if(op == COp::Number || op == COp::String || op == COp::Reference){
+            if(op == COp::Number)
+                builder.valNumber(reader.getDouble());
+            else if(op == COp::String)
+                builder.valString(reader.getString());
+            else{
+                unsigned char flags = reader.getByte();
+                int col = reader.getInt();
+                int row = reader.getInt();
+                if(flags > 3)
+                    throw std::invalid_argument("Invalid reference");
+                builder.valReference(col, row, flags & 1, flags & 2);
+                if(!(flags & 1)){
+                    range.min_col = std::min<long long>(range.min_col, col);
+                    range.max_col = std::max<long long>(range.max_col, col);
+                }
+                if(!(flags & 2)){
+                    range.min_row = std::min<long long>(range.min_row, row);
+                    range.max_row = std::max<long long>(range.max_row, row);
+                }
+            }
+            ++depth;
+            continue;
+        }
+        if(depth < (op == COp::Neg ? 1u : 2u))
+            throw std::invalid_argument("Missing operand");
+        switch(op){
+            case COp::Add: builder.opAdd(); break;
+            case COp::Sub: builder.opSub(); break;
+            case COp::Mul: builder.opMul(); break;
+            case COp::Div: builder.opDiv(); break;
+            case COp::Pow: builder.opPow(); break;
+            case COp::Neg: builder.opNeg(); break;
+            case COp::Eq: builder.opEq(); break;
+            case COp::Ne: builder.opNe(); break;
+            case COp::Lt: builder.opLt(); break;
+            case COp::Le: builder.opLe(); break;
+            case COp::Gt: builder.opGt(); break;
+            case COp::Ge: builder.opGe(); break;
+            default: throw std::invalid_argument("Invalid operation");
+        }
+        depth -= op != COp::Neg;
+    }
+    if(depth != 1)
+        throw std::invalid_argument("Invalid expression");
+    return builder.getAST();
+}
+
+CPos decodeCell(CBinaryReader& reader, CCell& cell, uint32_t& formula){
+    int col = reader.getInt();
+    int row = reader.getInt();
+    formula = NO_FORMULA;
+    switch((CCellKind)reader.getByte()){
+        case CCellKind::Number:
+            cell.value = reader.getDouble();
+            break;
+        case CCellKind::String:
+            cell.value = CBoxedValue(reader.getString());
+            break;
+        case CCellKind::Formula:
+            formula = reader.getUnsigned();
+            if(formula == NO_FORMULA)
+                throw std::invalid_argument("Invalid formula");
+            cell.col_shift = reader.getInt();
+            cell.row_shift = reader.getInt();
+            break;
+        default:
+            throw std::invalid_argument("Invalid cell");
+    }
+    return CPos(col, row);
+}
+
+//largest magnitude of an integer stored exactly by a double with all smaller ones
+static constexpr double MAX_EXACT_INTEGER = 9007199254740992.0;
+
+//return the value if it fits into an int, throw std::invalid_argument otherwise
+static int checkedInt(long long value){
+    if(value < INT_MIN || value > INT_MAX)
+        throw std::invalid_argument("Invalid coordinate");
+    return (int)value;
+}
+
+//read a difference and return the coordinate it leads to from base
+//a coordinate and an offset fit into an int, so a valid difference does not overflow when added to a valid base
+static long long addDelta(long long base, CBinaryReader& reader){
+    int64_t delta = reader.getSignedVarint();
+    if(delta < -(1ll << 34) || delta > (1ll << 34))
+        throw std::invalid_argument("Invalid coordinate");
+    return base + delta;
+}
+
+void CCellDeltaCoder::encodePos(CBinaryWriter& writer, const CPos& pos){
+    writer.putSignedVarint(pos.col() - col_);
+    writer.putSignedVarint(pos.row() - row_);
+    col_ = pos.col();
+    row_ = pos.row();
+}
+
+void CCellDeltaCoder::encodeValue(CBinaryWriter& writer, const CPos& pos, const CBoxedValue& value){
+    encodePos(writer, pos);
+    if(value.isNumber()){
+        double number = value.number();
+        //-0 is integral, but it would be loaded as 0
+        if(number == std::trunc(number) && std::fabs(number) < MAX_EXACT_INTEGER
+           && !(number == 0 && std::signbit(number))){
+            writer.putByte((unsigned char)CCellKind::Integer);
+            writer.putSignedVarint((long long)number);
+        }
+        else{
+            writer.putByte((unsigned char)CCellKind::Number);
+            writer.putDouble(number);
+        }
+        return;
+    }
+    writer.putByte((unsigned char)CCellKind::String);
+    std::string str = value.flatten();
+    writer.putVarint(str.size());
+    writer.putBytes(str);
+}
+
+void CCellDeltaCoder::encodeFormula(CBinaryWriter& writer, const CPos& pos, uint32_t formula, long long origin_col,
+                                    long long origin_row){
+    encodePos(writer, pos);
+    writer.putByte((unsigned char)CCellKind::Formula);
+    writer.putVarint(formula);
+    auto& [col, row] = origins_[formula];
+    writer.putSignedVarint(origin_col - col);
+    writer.putSignedVarint(origin_row - row);
+    col = origin_col;
+    row = origin_row;
+}
+
+CPos CCellDeltaCoder::decode(CBinaryReader& reader, CCell& cell, uint32_t& formula){
+    col_ = checkedInt(addDelta(col_, reader));
+    row_ = checkedInt(addDelta(row_, reader));
+    formula = NO_FORMULA;
+    switch((CCellKind)reader.getByte()){
+        case CCellKind::Number:
+            cell.value = reader.getDouble();
+            break;
+        case CCellKind::Integer:{
+            long long number = reader.getSignedVarint();
+            if(number <= -MAX_EXACT_INTEGER || number >= MAX_EXACT_INTEGER)
+                throw std::invalid_argument("Invalid number");
+            cell.value = (double)number;
+            break;
+        }
+        case CCellKind::String:
+            cell.value = CBoxedValue(reader.getBytes(reader.getVarint()));
+            break;
+        case CCellKind::Formula:{
+            uint64_t index = reader.getVarint();
+            if(index >= origins_.size())
+                throw std::invalid_argument("Invalid formula");
+            formula = (uint32_t)index;
+            //the origin may lie outside of an int, it is bounded by checking the offset
+            auto& [origin_col, origin_row] = origins_[formula];
+            origin_col = addDelta(origin_col, reader);
+            origin_row = addDelta(origin_row, reader);
+            cell.col_shift = checkedInt(col_ - origin_col);
+            cell.row_shift = checkedInt(row_ - origin_row);
+            break;
+        }
+        default:
+            throw std::invalid_argument("Invalid cell");
+    }
+    return CPos((int)col_, (int)row_);
+}
@@ -0,0 +1,113 @@
+#ifndef CBinaryFormat_h
+#define CBinaryFormat_h
+
+#include <climits>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "CBinary.h"
+#include "CFormula.h"
+
+class CASTBuilder;
+
+
+//layout of the binary save format
+//the header is BINARY_MAGIC followed by the version, the records come next in blocks, every block is preceded by its
+//size and followed by its CRC-32C and an empty block ends them (version 1 has no blocks and no checksums)
+//the records are the number of formulas, every formula, the number of cells and every cell, a record never spans
+//two blocks
+//since version 3 the cells of every tile start a new block and the records are followed by a block with the index
+//and by the footer, which holds the offset of the index and INDEX_MAGIC, so the index is found from the end of the file
+constexpr std::string_view BINARY_MAGIC = "FITX";
+constexpr uint32_t BINARY_VERSION = 3;
+constexpr std::string_view INDEX_MAGIC = "FITI";
+constexpr size_t BINARY_HEADER_SIZE = 8;
+constexpr size_t BINARY_FOOTER_SIZE = 12;
+//a block is never larger than this, unless it holds a single larger record
+constexpr uint32_t MAX_BINARY_BLOCK_SIZE = 1u << 30;
+//formula index of a cell that has no formula
+constexpr uint32_t NO_FORMULA = UINT32_MAX;
+
+//layout of the compressed save format
+//the header is COMPRESSED_MAGIC followed by the version, the records are those of the binary format in the same
+//order, but the cells are coded by CCellDeltaCoder, every block is compressed by lzCompress and preceded by its
+//compressed size and its size and followed by the CRC-32C of its decompressed data, an empty block ends them
+//the compressed format has no index, it is always loaded eagerly
+constexpr std::string_view COMPRESSED_MAGIC = "FITZ";
+constexpr uint32_t COMPRESSED_VERSION = 1;
+
+//kind of a cell in the binary format, integers are only used by the compressed format
+enum class CCellKind : unsigned char {
+    Number,
+    String,
+    Formula,
+    Integer
+};
+
+//range of the coordinates of the relative references of a formula, a cell may only shift them within an int
+struct CReferenceRange {
+    bool fits(int col_shift, int row_shift) const{
+        return min_col + col_shift >= INT_MIN && max_col + col_shift <= INT_MAX
+               && min_row + row_shift >= INT_MIN && max_row + row_shift <= INT_MAX;
+    }
+
+    long long min_col = 0, max_col = 0, min_row = 0, max_row = 0;
+};
+
+//consecutive blocks holding a part of the formula table or all cells of a tile
+struct CBlockSpan {
+    //offset of the first block in the file and the total size of the blocks with their sizes and checksums
+    uint64_t offset = 0;
+    uint64_t size = 0;
+    //index of the first formula in the span, 0 for tiles
+    uint32_t first = 0;
+    //number of formulas or cells in the span
+    uint32_t count = 0;
+};
+
+//index of a file of version 3, the spans of the formula table in order and the span of every tile by its key
+struct CBinaryIndex {
+    void serialize(CBinaryWriter& writer) const;
+    //throw std::invalid_argument if the index is not valid
+    static CBinaryIndex deserialize(CBinaryReader& reader);
+
+    std::vector<CBlockSpan> formula_blocks;
+    std::vector<std::pair<uint64_t, CBlockSpan>> tiles;
+};
+
+//rebuild the AST of a serialized program by replaying its instructions into the builder in postfix order
+//the range of its relative references is extended by them
+//throw std::invalid_argument if the instructions do not form a single expression
+CNode* decodeFormula(CBinaryReader& reader, CASTBuilder& builder, CReferenceRange& range);
+
+//decode a cell record and return the position of the cell, a cell with a formula gets its offset, but the formula
+//is only identified by its index, which is returned in formula, NO_FORMULA for other cells
+//throw std::invalid_argument if the record is not valid
+CPos decodeCell(CBinaryReader& reader, CCell& cell, uint32_t& formula);
+
+//coder of the cell records of the compressed format, which stores what is left after removing what repeats between
+//consecutive cells, cells must be coded and decoded in the same order starting from a new coder
+//the coordinates are stored as the difference from the previous cell, which is small in a tile saved row by row,
+//a formula cell stores the index of its formula and its origin, the position the formula is shifted from, which is
+//the cell minus its offset, as the difference from the origin of the previous cell with the same formula, so the
+//cells a formula was copied to take a few bytes each, integral numbers are stored as variable-length integers
+class CCellDeltaCoder {
+public:
+    explicit CCellDeltaCoder(uint32_t formula_count) : origins_(formula_count) {}
+
+    void encodeValue(CBinaryWriter& writer, const CPos& pos, const CBoxedValue& value);
+    void encodeFormula(CBinaryWriter& writer, const CPos& pos, uint32_t formula, long long origin_col,
+                       long long origin_row);
+
+    //decode a cell record like decodeCell, throw std::invalid_argument if the record is not valid
+    CPos decode(CBinaryReader& reader, CCell& cell, uint32_t& formula);
+
+private:
+    void encodePos(CBinaryWriter& writer, const CPos& pos);
+
+    long long col_ = 0, row_ = 0;
+    std::vector<std::pair<long long, long long>> origins_;
+};
+
+#endif /* CBinaryFormat_h */
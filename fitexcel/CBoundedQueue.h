@@ -0,0 +1,57 @@
+#ifndef CBoundedQueue_h
+#define CBoundedQueue_h
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+
+//queue passing items between the stages of a pipeline running on different threads
+//push waits while the queue is full and pop while it is empty, so a fast stage cannot run ahead of a slow one
+//closing the queue wakes all waiting threads, push then fails and pop fails once the remaining items are taken,
+//so the producer closes it after its last item and a stage that fails closes it to stop the others
+template<typename T>
+class CBoundedQueue {
+public:
+    explicit CBoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1) {}
+
+    bool push(T item){
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this]{ return closed_ || items_.size() < capacity_; });
+        if(closed_)
+            return false;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T& item){
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this]{ return closed_ || !items_.empty(); });
+        if(items_.empty())
+            return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close(){
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+};
+
+#endif /* CBoundedQueue_h */
@@ -0,0 +1,300 @@
+#ifndef CBoxedValue_h
+#define CBoxedValue_h
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "CValue.h"
+
+static_assert(sizeof(void*) == 8, "CBoxedValue stores pointers in the payload of a NaN");
+
+
+//compact 8-byte form of a cell value used by the evaluation and the value cache, converted to CValue only
+//when a value is returned to the user
+//a number is stored as the bits of the double itself, the empty value and strings are stored as negative quiet
+//NaNs with a tag - a string is a pointer to an immutable reference counted rope in the low 48 bits
+//so copying a value never allocates, even if it holds a string
+//a rope is either a flat buffer or the concatenation of two ropes, so concatenating long strings shares both
+//operands instead of copying them and a chain of concatenations costs time proportional to the total length,
+//the rope is flattened only when the value is converted to CValue
+//every NaN is stored as the same positive quiet NaN, so a number can never be mistaken for a tagged value
+class CBoxedValue {
+public:
+    CBoxedValue() : bits_(EMPTY) {}
+
+    CBoxedValue(double number){
+        if(std::isnan(number))
+            bits_ = CANONICAL_NAN;
+        else
+            std::memcpy(&bits_, &number, sizeof(bits_));
+    }
+
+    explicit CBoxedValue(std::string_view str) : CBoxedValue(new CString{{1}, str.size(), std::string(str), nullptr, nullptr}) {}
+
+    //return the concatenation of two strings, short results are copied into a flat buffer
+    static CBoxedValue concat(const CBoxedValue& left, const CBoxedValue& right){
+        const CString* l = left.buffer();
+        const CString* r = right.buffer();
+        if(r->length == 0)
+            return left;
+        if(l->length == 0)
+            return right;
+        if(l->length + r->length <= FLAT_LENGTH){
+            std::string res = left.flatten();
+            res += right.flatten();
+            return CBoxedValue(std::string_view(res));
+        }
+        l->refs.fetch_add(1, std::memory_order_relaxed);
+        r->refs.fetch_add(1, std::memory_order_relaxed);
+        return CBoxedValue(new CString{{1}, l->length + r->length, std::string(), l, r});
+    }
+
+    explicit CBoxedValue(const CValue& value) : CBoxedValue(){
+        if(const double* number = std::get_if<double>(&value))
+            *this = CBoxedValue(*number);
+        else if(const std::string* str = std::get_if<std::string>(&value))
+            *this = CBoxedValue(std::string_view(*str));
+    }
+
+    CBoxedValue(const CBoxedValue& src) : bits_(src.bits_){
+        if(isString())
+            buffer()->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    CBoxedValue(CBoxedValue&& src) noexcept : bits_(src.bits_){
+        src.bits_ = EMPTY;
+    }
+
+    CBoxedValue& operator =(const CBoxedValue& other){
+        CBoxedValue copy(other);
+        std::swap(bits_, copy.bits_);
+        return *this;
+    }
+
+    CBoxedValue& operator =(CBoxedValue&& other) noexcept{
+        std::swap(bits_, other.bits_);
+        return *this;
+    }
+
+    ~CBoxedValue(){
+        if(isString())
+            release(buffer());
+    }
+
+    bool empty() const{ return bits_ == EMPTY; }
+    bool isNumber() const{ return (bits_ >> 48) < (EMPTY >> 48); }
+    bool isString() const{ return (bits_ >> 48) == (STRING >> 48); }
+
+    double number() const{
+        double res;
+        std::memcpy(&res, &bits_, sizeof(res));
+        return res;
+    }
+
+    //return the contents of a string value as a single string
+    std::string flatten() const{
+        std::string res;
+        res.reserve(buffer()->length);
+        CSegments segments(buffer());
+        for(std::string_view segment; segments.next(segment);)
+            res += segment;
+        return res;
+    }
+
+    //call fn with every segment of the contents of a string value in order, without flattening it
+    template<typename F>
+    void forEachSegment(F&& fn) const{
+        CSegments segments(buffer());
+        for(std::string_view segment; segments.next(segment);)
+            fn(segment);
+    }
+
+    //compare the contents of two string values, return a negative number, zero or a positive number
+    //if the first one is less than, equal to or greater than the second one
+    static int compareStrings(const CBoxedValue& left, const CBoxedValue& right){
+        if(left.bits_ == right.bits_)
+            return 0;
+        if(!left.buffer()->left && !right.buffer()->left)
+            return left.buffer()->str.compare(right.buffer()->str);
+        CSegments l(left.buffer()), r(right.buffer());
+        std::string_view ls, rs;
+        bool l_more = l.next(ls), r_more = r.next(rs);
+        while(l_more && r_more){
+            size_t n = std::min(ls.size(), rs.size());
+            if(int res = ls.substr(0, n).compare(rs.substr(0, n)))
+                return res;
+            ls.remove_prefix(n);
+            rs.remove_prefix(n);
+            if(ls.empty())
+                l_more = l.next(ls);
+            if(rs.empty())
+                r_more = r.next(rs);
+        }
+        return (int)l_more - (int)r_more;
+    }
+
+    CValue toValue() const{
+        if(isNumber())
+            return number();
+        if(isString())
+            return flatten();
+        return CValue();
+    }
+
+    //values are equal if they are of the same type and hold equal numbers or strings, as with CValue
+    bool operator ==(const CBoxedValue& other) const{
+        if(isNumber() && other.isNumber())
+            return number() == other.number();
+        if(isString() && other.isString())
+            return buffer()->length == other.buffer()->length && compareStrings(*this, other) == 0;
+        return empty() && other.empty();
+    }
+
+private:
+    //a flat buffer holds its contents in str, a concatenation holds its operands in left and right
+    struct CString {
+        mutable std::atomic<size_t> refs;
+        size_t length;
+        std::string str;
+        const CString* left;
+        const CString* right;
+    };
+
+    //reads the flat buffers of a rope from left to right, the rope is traversed without recursion,
+    //since a chain of concatenations may be arbitrarily deep
+    class CSegments {
+    public:
+        explicit CSegments(const CString* root) : stack_{root} {}
+        bool next(std::string_view& segment){
+            while(!stack_.empty()){
+                const CString* cur = stack_.back();
+                stack_.pop_back();
+                if(!cur->left){
+                    if(cur->length == 0)
+                        continue;
+                    segment = cur->str;
+                    return true;
+                }
+                stack_.push_back(cur->right);
+                stack_.push_back(cur->left);
+            }
+            return false;
+        }
+    private:
+        std::vector<const CString*> stack_;
+    };
+
+    //strings up to this length are always stored flat
+    static constexpr size_t FLAT_LENGTH = 64;
+
+    static constexpr uint64_t CANONICAL_NAN = 0x7FF8000000000000;
+    static constexpr uint64_t EMPTY = 0xFFFC000000000000;
+    static constexpr uint64_t STRING = 0xFFFD000000000000;
+    static constexpr uint64_t PAYLOAD = 0x0000FFFFFFFFFFFF;
+
+    explicit CBoxedValue(const CString* str) : bits_(STRING | (uint64_t)(uintptr_t)str) {}
+
+    const CString* buffer() const{
+        return (const CString*)(uintptr_t)(bits_ & PAYLOAD);
+    }
+
+    //drop a reference to the rope, the parts of a concatenation that are no longer used are freed without recursion
+    static void release(const CString* str){
+        if(str->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        std::vector<const CString*> pending{str};
+        while(!pending.empty()){
+            const CString* cur = pending.back();
+            pending.pop_back();
+            for(const CString* part : {cur->left, cur->right})
+                if(part && part->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    pending.push_back(part);
+            delete cur;
+        }
+    }
+
+    uint64_t bits_;
+};
+
+static_assert(sizeof(CBoxedValue) == 8);
+
+
+//operations on boxed values with the same results as the operations on CValue
+
+inline CBoxedValue addValues(const CBoxedValue& left, const CBoxedValue& right){
+    if(left.isNumber() && right.isNumber())
+        return left.number() + right.number();
+    if(left.isString() && right.isString())
+        return CBoxedValue::concat(left, right);
+    return CBoxedValue();
+}
+
+inline CBoxedValue subValues(const CBoxedValue& left, const CBoxedValue& right){
+    if(left.isNumber() && right.isNumber())
+        return left.number() - right.number();
+    return CBoxedValue();
+}
+
+inline CBoxedValue mulValues(const CBoxedValue& left, const CBoxedValue& right){
+    if(left.isNumber() && right.isNumber())
+        return left.number() * right.number();
+    return CBoxedValue();
+}
+
+inline CBoxedValue divValues(const CBoxedValue& left, const CBoxedValue& right){
+    if(left.isNumber() && right.isNumber() && right.number() != 0)
+        return left.number() / right.number();
+    return CBoxedValue();
+}
+
+inline CBoxedValue powValues(const CBoxedValue& left, const CBoxedValue& right){
+    if(left.isNumber() && right.isNumber())
+        return pow(left.number(), right.number());
+    return CBoxedValue();
+}
+
+inline CBoxedValue negValue(const CBoxedValue& child){
+    if(child.isNumber())
+        return -child.number();
+    return CBoxedValue();
+}
+
+inline CBoxedValue eqValues(const CBoxedValue& left, const CBoxedValue& right){
+    return (left == right) * 1.0;
+}
+
+inline CBoxedValue neValues(const CBoxedValue& left, const CBoxedValue& right){
+    return !(left == right) * 1.0;
+}
+
+template<typename Cmp>
+CBoxedValue compareValues(const CBoxedValue& left, const CBoxedValue& right, Cmp cmp){
+    if(left.isNumber() && right.isNumber())
+        return cmp(left.number(), right.number()) * 1.0;
+    if(left.isString() && right.isString())
+        return cmp(CBoxedValue::compareStrings(left, right), 0) * 1.0;
+    return CBoxedValue();
+}
+
+inline CBoxedValue ltValues(const CBoxedValue& left, const CBoxedValue& right){
+    return compareValues(left, right, [](const auto& a, const auto& b){ return a < b; });
+}
+
+inline CBoxedValue leValues(const CBoxedValue& left, const CBoxedValue& right){
+    return compareValues(left, right, [](const auto& a, const auto& b){ return a <= b; });
+}
+
+inline CBoxedValue gtValues(const CBoxedValue& left, const CBoxedValue& right){
+    return compareValues(left, right, [](const auto& a, const auto& b){ return a > b; });
+}
+
+inline CBoxedValue geValues(const CBoxedValue& left, const CBoxedValue& right){
+    return compareValues(left, right, [](const auto& a, const auto& b){ return a >= b; });
+}
+
+#endif /* CBoxedValue_h */
@@ -0,0 +1,38 @@
+#ifndef CCow_h
+#define CCow_h
+
+#include <memory>
+#include <utility>
+
+
+//copy-on-write handle of a value, copies of the handle share the value until one of them modifies it
+//edit copies the value first if it is shared, so copying a handle is O(1) and the cost of a copy is paid
+//only by the parts that are actually modified afterwards
+//a value may be shared by handles used on different threads only as long as none of them is modified
+template<typename T>
+class CCow {
+public:
+    const T& operator *() const{ return *get(); }
+    const T* operator ->() const{ return get(); }
+
+    //return the value for modification, detach it from the other handles first if it is shared
+    T& edit(){
+        if(!value_)
+            value_ = std::make_shared<T>();
+        else if(value_.use_count() != 1)
+            value_ = std::make_shared<T>(std::as_const(*value_));
+        return *value_;
+    }
+
+private:
+    //a handle that was never modified or was moved from holds no value and reads as a default constructed one,
+    //so creating and moving a handle does not allocate
+    const T* get() const{
+        static const T empty;
+        return value_ ? value_.get() : &empty;
+    }
+
+    std::shared_ptr<T> value_;
+};
+
+#endif /* CCow_h */
@@ -0,0 +1,205 @@
+#ifndef CCowMap_h
+#define CCowMap_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "CCow.h"
+
+
+//map from 64-bit keys to values kept as a hash trie of copy-on-write nodes
+//a leaf holds up to LEAF_SIZE entries, a fuller one becomes an inner node whose children are selected by the next
+//BITS bits of the hashed key, so a copy of the map shares all nodes with the original and a modification copies
+//only the nodes on the path to its entry - O(log n) nodes of at most FANOUT children or LEAF_SIZE entries each
+//the root is kept in the map itself, so a map of a few entries takes a single allocation and copying a map copies
+//at most FANOUT children or LEAF_SIZE entries
+//a value is copied together with its leaf, so large values are better kept behind a shared pointer
+//iteration visits the entries in no particular order, references to entries stay valid until the map is modified
+template<typename T>
+class CCowMap {
+public:
+    using value_type = std::pair<uint64_t, T>;
+
+private:
+    //a wide node keeps the trie of a few thousand entries three levels deep, so a lookup is not much slower than in
+    //a hash table
+    static constexpr int BITS = 6;
+    static constexpr size_t FANOUT = 1 << BITS;
+    //depth of the nodes that are never split, the top BITS * LEVELS bits of the hashed key select their path
+    static constexpr int LEVELS = 64 / BITS;
+    static constexpr size_t LEAF_SIZE = 8;
+
+    //a leaf has no children, an inner node has FANOUT of them and no entries
+    struct CNode {
+        std::vector<value_type> entries;
+        std::vector<CCow<CNode>> children;
+    };
+
+    //the multiplication by an odd constant carries the differences of close keys into the top bits, which select
+    //the path
+    static uint64_t hash(uint64_t key){
+        return key * 0x9E3779B97F4A7C15ULL;
+    }
+
+    static size_t child(uint64_t hash, int level){
+        return (hash >> (64 - BITS * (level + 1))) & (FANOUT - 1);
+    }
+
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = CCowMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = const value_type&;
+        using pointer = const value_type*;
+
+        const_iterator() = default;
+
+        reference operator *() const{ return nodes_[depth_ - 1]->entries[entry_]; }
+        pointer operator ->() const{ return &nodes_[depth_ - 1]->entries[entry_]; }
+        const_iterator& operator ++(){
+            ++entry_;
+            settle();
+            return *this;
+        }
+        const_iterator operator ++(int){
+            const_iterator res = *this;
+            ++*this;
+            return res;
+        }
+        bool operator ==(const const_iterator& other) const{
+            return depth_ == other.depth_
+                   && (depth_ == 0 || (nodes_[depth_ - 1] == other.nodes_[depth_ - 1] && entry_ == other.entry_));
+        }
+        bool operator !=(const const_iterator& other) const{ return !(*this == other); }
+
+    private:
+        friend class CCowMap;
+
+        explicit const_iterator(const CNode* root) : depth_(1){
+            nodes_[0] = root;
+            settle();
+        }
+
+        //descend from the current position to the first entry that is not visited yet, the end has an empty path
+        void settle(){
+            while(depth_ > 0){
+                const CNode* node = nodes_[depth_ - 1];
+                if(node->children.empty() && entry_ < node->entries.size())
+                    return;
+                if(!node->children.empty() && next_[depth_ - 1] < FANOUT){
+                    nodes_[depth_] = &*node->children[next_[depth_ - 1]];
+                    next_[depth_++] = 0;
+                    entry_ = 0;
+                }
+                else if(--depth_ > 0)
+                    ++next_[depth_ - 1];
+            }
+        }
+
+        //nodes from the root to the current leaf and the child of every inner node on the path that is visited
+        const CNode* nodes_[LEVELS + 1] = {};
+        unsigned char next_[LEVELS + 1] = {};
+        size_t depth_ = 0;
+        size_t entry_ = 0;
+    };
+
+    CCowMap() = default;
+    CCowMap(const CCowMap& src) = default;
+    CCowMap& operator =(const CCowMap& other) = default;
+    //the map moved from is left empty
+    CCowMap(CCowMap&& src) noexcept : root_(std::exchange(src.root_, CNode())), size_(std::exchange(src.size_, 0)) {}
+    CCowMap& operator =(CCowMap&& other) noexcept{
+        if(this != &other){
+            root_ = std::exchange(other.root_, CNode());
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    //return the value stored with the key, nullptr if there is none
+    const T* find(uint64_t key) const{
+        uint64_t h = hash(key);
+        const CNode* node = &root_;
+        for(int level = 0; !node->children.empty(); ++level)
+            node = &*node->children[child(h, level)];
+        for(const value_type& entry : node->entries)
+            if(entry.first == key)
+                return &entry.second;
+        return nullptr;
+    }
+
+    //return the value stored with the key for modification, a default constructed value is inserted if there is none
+    T& operator [](uint64_t key){
+        return *insert(key, []{ return T(); }).first;
+    }
+
+    //store the value with the key if there is none, return the value stored with the key and whether it was inserted
+    std::pair<T*, bool> emplace(uint64_t key, T value){
+        return insert(key, [&value]{ return std::move(value); });
+    }
+
+    //remove the value stored with the key, the last entry of its leaf takes its place, return false if there was none
+    //inner nodes are kept even if all entries below them are removed
+    bool erase(uint64_t key){
+        if(!find(key))
+            return false;
+        uint64_t h = hash(key);
+        CNode* node = &root_;
+        for(int level = 0; !node->children.empty(); ++level)
+            node = &node->children[child(h, level)].edit();
+        auto it = std::find_if(node->entries.begin(), node->entries.end(),
+                               [key](const value_type& entry){ return entry.first == key; });
+        if(it + 1 != node->entries.end())
+            *it = std::move(node->entries.back());
+        node->entries.pop_back();
+        --size_;
+        return true;
+    }
+
+    void clear(){
+        root_ = CNode();
+        size_ = 0;
+    }
+
+    size_t size() const{ return size_; }
+    bool empty() const{ return size_ == 0; }
+
+    const_iterator begin() const{ return const_iterator(&root_); }
+    const_iterator end() const{ return const_iterator(); }
+
+private:
+    //find the entry of the key in a leaf copied on the path from the root, an entry with the value returned by make()
+    //is added if there is none
+    template<typename F>
+    std::pair<T*, bool> insert(uint64_t key, F&& make){
+        uint64_t h = hash(key);
+        CNode* node = &root_;
+        for(int level = 0;; ++level){
+            if(node->children.empty()){
+                for(value_type& entry : node->entries)
+                    if(entry.first == key)
+                        return {&entry.second, false};
+                if(node->entries.size() < LEAF_SIZE || level == LEVELS){
+                    ++size_;
+                    return {&node->entries.emplace_back(key, make()).second, true};
+                }
+                //a full leaf becomes an inner node, its entries move to its new children
+                node->children.resize(FANOUT);
+                for(value_type& entry : node->entries)
+                    node->children[child(hash(entry.first), level)].edit().entries.push_back(std::move(entry));
+                std::vector<value_type>().swap(node->entries);
+            }
+            node = &node->children[child(h, level)].edit();
+        }
+    }
+
+    CNode root_;
+    size_t size_ = 0;
+};
+
+#endif /* CCowMap_h */
@@ -0,0 +1,89 @@
+#ifndef CCrc32c_h
+#define CCrc32c_h
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+
+//CRC32C_TABLES[k][b] is the checksum of the byte b followed by k zero bytes, the polynomial is reflected
+constexpr std::array<std::array<uint32_t, 256>, 8> makeCrc32cTables(){
+    constexpr uint32_t POLYNOMIAL = 0x82f63b78;
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for(uint32_t b = 0; b < 256; ++b){
+        uint32_t crc = b;
+        for(int i = 0; i < 8; ++i)
+            crc = crc & 1 ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+        tables[0][b] = crc;
+    }
+    for(size_t k = 1; k < 8; ++k)
+        for(uint32_t b = 0; b < 256; ++b)
+            tables[k][b] = tables[0][tables[k - 1][b] & 0xff] ^ (tables[k - 1][b] >> 8);
+    return tables;
+}
+
+inline constexpr std::array<std::array<uint32_t, 256>, 8> CRC32C_TABLES = makeCrc32cTables();
+
+
+//incremental CRC-32C (Castagnoli) checksum, data may be added in any number of pieces
+//the crc32 instruction of SSE4.2 is used if the compiler targets it, a table processing 8 bytes at once otherwise
+class CCrc32c {
+public:
+    void update(std::string_view data){
+        const char* p = data.data();
+        size_t size = data.size();
+        uint32_t crc = crc_;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+        uint64_t crc64 = crc;
+        for(; size >= 8; p += 8, size -= 8){
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = (uint32_t)crc64;
+        for(; size > 0; ++p, --size)
+            crc = _mm_crc32_u8(crc, (unsigned char)*p);
+#else
+        for(; size >= 8; p += 8, size -= 8){
+            uint32_t low = crc ^ load(p);
+            uint32_t high = load(p + 4);
+            crc = CRC32C_TABLES[7][low & 0xff] ^ CRC32C_TABLES[6][(low >> 8) & 0xff]
+                  ^ CRC32C_TABLES[5][(low >> 16) & 0xff] ^ CRC32C_TABLES[4][low >> 24]
+                  ^ CRC32C_TABLES[3][high & 0xff] ^ CRC32C_TABLES[2][(high >> 8) & 0xff]
+                  ^ CRC32C_TABLES[1][(high >> 16) & 0xff] ^ CRC32C_TABLES[0][high >> 24];
+        }
+        for(; size > 0; ++p, --size)
+            crc = CRC32C_TABLES[0][(crc ^ (unsigned char)*p) & 0xff] ^ (crc >> 8);
+#endif
+        crc_ = crc;
+    }
+
+    uint32_t value() const{
+        return ~crc_;
+    }
+
+    void reset(){
+        crc_ = ~0u;
+    }
+
+    static uint32_t of(std::string_view data){
+        CCrc32c crc;
+        crc.update(data);
+        return crc.value();
+    }
+
+private:
+    //little-endian word, so the table method gives the same checksum on every machine
+    static uint32_t load(const char* p){
+        const unsigned char* b = (const unsigned char*)p;
+        return b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+    }
+
+    uint32_t crc_ = ~0u;
+};
+
+#endif /* CCrc32c_h */
@@ -0,0 +1,20 @@
+#ifndef CEvaluator_h
+#define CEvaluator_h
+
+#include "CBoxedValue.h"
+#include "CPos.h"
+
+
+//interface through which an expression obtains the values of the cells it references
+//compiled programs read the compact boxed values, an evaluator that stores them overrides boxedValueAt as well,
+//so no value has to be converted on the way
+struct CEvaluator {
+    virtual CValue valueAt(const CPos& pos) = 0;
+    virtual CBoxedValue boxedValueAt(const CPos& pos){
+        return CBoxedValue(valueAt(pos));
+    }
+protected:
+    ~CEvaluator() = default;
+};
+
+#endif /* CEvaluator_h */
@@ -0,0 +1,96 @@
+#ifndef CFormula_h
+#define CFormula_h
+
+#include <memory>
+#include "CNode.h"
+
+
+//immutable expression shared by all cells filled from it
+//it is evaluated by running its compiled program, the AST is kept for reconstructing the expression when saving
+//the nodes of the AST live in the arena of the builder that created it, the formula keeps the arena alive
+//references that are not absolute are shifted by the offset of the cell evaluating the formula
+class CFormula {
+public:
+    //compile the AST allocated in the arena
+    CFormula(const CNode* ast, std::shared_ptr<const CArena> arena) : ast_(ast), arena_(std::move(arena)){
+        ast_->compile(program_);
+    }
+    CFormula(const CFormula& src) = delete;
+    CFormula& operator =(const CFormula& other) = delete;
+
+    CBoxedValue evaluate(CEvaluator& ev, int w = 0, int h = 0) const{
+        return program_.run(ev, w, h);
+    }
+
+    void collectReferences(std::vector<CPos>& refs, int w = 0, int h = 0) const{
+        program_.collectReferences(refs, w, h);
+    }
+
+    void write(std::string& out, int w = 0, int h = 0) const{
+        ast_->write(out, w, h);
+    }
+
+    std::string reconstruct(int w = 0, int h = 0) const{
+        return ast_->reconstruct(w, h);
+    }
+
+    const CProgram& program() const{
+        return program_;
+    }
+
+    const CNode* ast() const{
+        return ast_;
+    }
+
+private:
+    const CNode* ast_;
+    std::shared_ptr<const CArena> arena_;
+    CProgram program_;
+};
+
+
+//content of a non-empty cell - a handle of a shared formula together with the offset of the cell
+//from the cell the formula was written to, copying a cell only copies the handle and adjusts the offset
+//a cell holding a number or a string has no formula, its value is stored in the cell itself
+struct CCell {
+    bool empty() const{
+        return !formula && value.empty();
+    }
+
+    CBoxedValue evaluate(CEvaluator& ev) const{
+        if(!formula)
+            return value;
+        return formula->evaluate(ev, col_shift, row_shift);
+    }
+
+    void collectReferences(std::vector<CPos>& refs) const{
+        if(formula)
+            formula->collectReferences(refs, col_shift, row_shift);
+    }
+
+    //append the expression of the cell, see CNode::write
+    void write(std::string& out) const{
+        if(formula)
+            formula->write(out, col_shift, row_shift);
+        else if(value.isNumber())
+            writeNumber(out, value.number());
+        else{
+            out.push_back('\"');
+            value.forEachSegment([&out](std::string_view segment){ writeStringContents(out, segment); });
+            out.push_back('\"');
+        }
+    }
+
+    std::string reconstruct() const{
+        std::string res;
+        write(res);
+        return res;
+    }
+
+    std::shared_ptr<const CFormula> formula;
+    int col_shift = 0;
+    int row_shift = 0;
+    CBoxedValue value;
+};
+
+#endif /* CFormula_h */
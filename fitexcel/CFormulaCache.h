@@ -0,0 +1,73 @@
+#ifndef CFormulaCache_h
+#define CFormulaCache_h
+
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include "CFormula.h"
+
+
+//bounded cache mapping the text of a formula to the cell parsed from it, cells set to the same text share one
+//immutable formula, so a repeated formula is parsed and compiled only once and its tree is stored only once
+//the least recently used entry is evicted when the cache is full, the counters of hits and misses are kept
+//for tuning the capacity
+class CFormulaCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 4096;
+
+    explicit CFormulaCache(size_t capacity = DEFAULT_CAPACITY) : capacity_(capacity) {}
+    CFormulaCache(const CFormulaCache& src) = delete;
+    CFormulaCache& operator =(const CFormulaCache& other) = delete;
+
+    //return the cell parsed from the text, nullptr if it is not cached
+    const CCell* find(std::string_view text){
+        auto it = index_.find(text);
+        if(it == index_.end()){
+            ++misses_;
+            return nullptr;
+        }
+        ++hits_;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return &it->second->second;
+    }
+
+    void insert(std::string_view text, const CCell& cell){
+        if(capacity_ == 0 || index_.count(text))
+            return;
+        if(entries_.size() == capacity_){
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+        entries_.emplace_front(std::string(text), cell);
+        index_.emplace(entries_.front().first, entries_.begin());
+    }
+
+    //change the maximal number of entries, the least recently used ones are evicted if there are more of them
+    void setCapacity(size_t capacity){
+        capacity_ = capacity;
+        while(entries_.size() > capacity_){
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+    }
+
+    size_t capacity() const{ return capacity_; }
+    size_t size() const{ return entries_.size(); }
+    size_t hits() const{ return hits_; }
+    size_t misses() const{ return misses_; }
+
+private:
+    using CEntries = std::list<std::pair<std::string, CCell>>;
+
+    //most recently used entries first
+    CEntries entries_;
+    //the keys view the texts stored in entries_, which never move
+    std::unordered_map<std::string_view, CEntries::iterator> index_;
+    size_t capacity_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+};
+
+#endif /* CFormulaCache_h */
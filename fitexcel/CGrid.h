@@ -0,0 +1,249 @@
+#ifndef CGrid_h
+#define CGrid_h
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "CCow.h"
+#include "CCowMap.h"
+#include "CPos.h"
+
+
+//sparse two-dimensional storage of values indexed by cell coordinates
+//the plane is divided into square tiles of TILE_SIZE x TILE_SIZE cells located through a hash trie by the
+//coordinates of the tile, a tile keeps a dense array of its present cells with their offsets in the tile
+//a sparse tile is searched through the offsets, a tile of more than SPARSE_LIMIT cells also maps every offset to its
+//cell, so a lookup costs one hash of the tile and a short scan or one array access, and iterating over a tile only
+//touches present cells
+//iteration visits the cells in no particular order, erasing a cell may move other cells of its tile
+//the trie of tiles and every tile are copy-on-write, so a copy of the grid shares all tiles with the original and
+//a modification copies only the tile it touches and the O(log tiles) nodes of the trie on the path to it
+//pointers returned by find stay valid until the grid is modified
+template<typename T>
+class CGrid {
+public:
+    using value_type = std::pair<CPos, T>;
+
+    static constexpr int TILE_BITS = 6;
+    static constexpr int TILE_SIZE = 1 << TILE_BITS;
+    //the most cells of a tile searched through their offsets, the map of all offsets of a tile takes 8 KiB
+    static constexpr size_t SPARSE_LIMIT = 64;
+
+private:
+    struct CTile {
+        //offsets of the cells in the tile, in the order of entries
+        std::vector<uint16_t> offsets;
+        //index + 1 of the cell in entries for every offset, 0 if the cell is not present
+        //only a tile of more than SPARSE_LIMIT cells has it, it is released once half of them are erased
+        std::vector<uint16_t> slots;
+        std::vector<value_type> entries;
+
+        //return the index of the cell at the offset in entries, the number of entries if it is not present
+        size_t index(size_t offset) const{
+            if(!slots.empty())
+                return slots[offset] ? slots[offset] - 1 : entries.size();
+            return std::find(offsets.begin(), offsets.end(), (uint16_t)offset) - offsets.begin();
+        }
+    };
+    using CTiles = CCowMap<CCow<CTile>>;
+
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = CGrid::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = const value_type&;
+        using pointer = const value_type*;
+
+        const_iterator() = default;
+        explicit const_iterator(typename CTiles::const_iterator tile) : tile_(tile) {}
+
+        reference operator *() const{ return tile_->second->entries[entry_]; }
+        pointer operator ->() const{ return &tile_->second->entries[entry_]; }
+        const_iterator& operator ++(){
+            if(++entry_ == tile_->second->entries.size()){
+                ++tile_;
+                entry_ = 0;
+            }
+            return *this;
+        }
+        const_iterator operator ++(int){
+            const_iterator res = *this;
+            ++*this;
+            return res;
+        }
+        bool operator ==(const const_iterator& other) const{ return tile_ == other.tile_ && entry_ == other.entry_; }
+        bool operator !=(const const_iterator& other) const{ return !(*this == other); }
+
+    private:
+        typename CTiles::const_iterator tile_;
+        size_t entry_ = 0;
+    };
+    using iterator = const_iterator;
+
+    CGrid() = default;
+    CGrid(const CGrid& src) = default;
+    CGrid& operator =(const CGrid& other) = default;
+    //the grid moved from is left empty
+    CGrid(CGrid&& src) noexcept : tiles_(std::move(src.tiles_)), size_(std::exchange(src.size_, 0)) {}
+    CGrid& operator =(CGrid&& other) noexcept{
+        if(this != &other){
+            tiles_ = std::move(other.tiles_);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    //return the value stored at the position, nullptr if there is none
+    const T* find(const CPos& pos) const{
+        const CCow<CTile>* tile = tiles_.find(tileKey(pos));
+        if(!tile)
+            return nullptr;
+        size_t index = (*tile)->index(offset(pos));
+        return index < (*tile)->entries.size() ? &(*tile)->entries[index].second : nullptr;
+    }
+
+    //return the value stored at the position for modification, nullptr if there is none
+    T* modify(const CPos& pos){
+        if(!find(pos))
+            return nullptr;
+        CTile& tile = tiles_[tileKey(pos)].edit();
+        return &tile.entries[tile.index(offset(pos))].second;
+    }
+
+    //store the value at each of out.size() positions of column col, starting at row and following by step rows, to
+    //out, nullptr if there is none - the tile of consecutive positions is looked up only once
+    void findColumn(int col, int row, int step, std::span<const T*> out) const{
+        uint64_t key = 0;
+        const CTile* tile = nullptr;
+        for(size_t i = 0; i < out.size(); ++i){
+            CPos pos(col, row + step * (int)i);
+            if(i == 0 || tileKey(pos) != key){
+                key = tileKey(pos);
+                const CCow<CTile>* found = tiles_.find(key);
+                tile = found ? &**found : nullptr;
+            }
+            size_t index = tile ? tile->index(offset(pos)) : 0;
+            out[i] = tile && index < tile->entries.size() ? &tile->entries[index].second : nullptr;
+        }
+    }
+
+    size_t count(const CPos& pos) const{
+        return find(pos) != nullptr;
+    }
+
+    const T& at(const CPos& pos) const{
+        const T* res = find(pos);
+        if(!res)
+            throw std::out_of_range("CGrid::at");
+        return *res;
+    }
+
+    //return the value stored at the position, a default constructed value is inserted if there is none
+    T& operator [](const CPos& pos){
+        return slot(tiles_[tileKey(pos)].edit(), pos);
+    }
+
+    T& insert_or_assign(const CPos& pos, T value){
+        T& res = (*this)[pos];
+        res = std::move(value);
+        return res;
+    }
+
+    //store the value returned by fn(i) at each of count positions of column col, starting at row and following by step
+    //rows, a position for which fn returns an empty std::optional is left as it is - the tile of consecutive positions
+    //is looked up and detached from the copies of the grid only once
+    template<typename F>
+    void assignColumn(int col, int row, int step, size_t count, F&& fn){
+        uint64_t key = 0;
+        CTile* tile = nullptr;
+        for(size_t i = 0; i < count; ++i){
+            std::optional<T> value = fn(i);
+            if(!value)
+                continue;
+            CPos pos(col, row + step * (int)i);
+            if(!tile || tileKey(pos) != key){
+                key = tileKey(pos);
+                tile = &tiles_[key].edit();
+            }
+            slot(*tile, pos) = std::move(*value);
+        }
+    }
+
+    //remove the value stored at the position, the last cell of the tile takes its place
+    //return false if there was none
+    bool erase(const CPos& pos){
+        if(!find(pos))
+            return false;
+        CTile& tile = tiles_[tileKey(pos)].edit();
+        size_t off = offset(pos);
+        size_t index = tile.index(off);
+        if(!tile.slots.empty())
+            tile.slots[off] = 0;
+        if(index + 1 != tile.entries.size()){
+            tile.entries[index] = std::move(tile.entries.back());
+            tile.offsets[index] = tile.offsets.back();
+            if(!tile.slots.empty())
+                tile.slots[tile.offsets[index]] = (uint16_t)(index + 1);
+        }
+        tile.entries.pop_back();
+        tile.offsets.pop_back();
+        if(tile.entries.empty())
+            tiles_.erase(tileKey(pos));
+        else if(!tile.slots.empty() && tile.entries.size() <= SPARSE_LIMIT / 2)
+            std::vector<uint16_t>().swap(tile.slots);
+        --size_;
+        return true;
+    }
+
+    void clear(){
+        tiles_.clear();
+        size_ = 0;
+    }
+
+    size_t size() const{ return size_; }
+    bool empty() const{ return size_ == 0; }
+
+    //tiles without cells are removed, so every tile in the table has an entry to start from
+    const_iterator begin() const{ return const_iterator(tiles_.begin()); }
+    const_iterator end() const{ return const_iterator(tiles_.end()); }
+
+    //key of the tile containing the position, the cells of a tile are visited one after another by the iteration
+    static uint64_t tileKey(const CPos& pos){
+        return ((uint64_t)(uint32_t)(pos.col() >> TILE_BITS) << 32) | (uint32_t)(pos.row() >> TILE_BITS);
+    }
+
+private:
+    static size_t offset(const CPos& pos){
+        return (size_t)(pos.col() & (TILE_SIZE - 1)) << TILE_BITS | (size_t)(pos.row() & (TILE_SIZE - 1));
+    }
+
+    //return the value stored at the position in its tile, a default constructed value is inserted if there is none
+    T& slot(CTile& tile, const CPos& pos){
+        size_t off = offset(pos);
+        size_t index = tile.index(off);
+        if(index == tile.entries.size()){
+            tile.entries.emplace_back(pos, T());
+            tile.offsets.push_back((uint16_t)off);
+            if(!tile.slots.empty())
+                tile.slots[off] = (uint16_t)tile.entries.size();
+            else if(tile.entries.size() > SPARSE_LIMIT){
+                tile.slots.assign(TILE_SIZE * TILE_SIZE, 0);
+                for(size_t i = 0; i < tile.offsets.size(); ++i)
+                    tile.slots[tile.offsets[i]] = (uint16_t)(i + 1);
+            }
+            ++size_;
+        }
+        return tile.entries[index].second;
+    }
+
+    CTiles tiles_;
+    size_t size_ = 0;
+};
+
+#endif /* CGrid_h */
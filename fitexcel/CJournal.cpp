@@ -0,0 +1,112 @@
+#include <filesystem>
+#include <stdexcept>
+#include "CBinary.h"
+#include "CCrc32c.h"
+#include "CJournal.h"
+
+CJournal::CJournal(std::string filename, uint64_t min_size) : filename_(std::move(filename)),
+                                                              journal_filename_(filename_ + ".journal"),
+                                                              min_size_(min_size){}
+
+//read the whole file, return false if it does not exist, throw std::runtime_error if it cannot be read
+static bool readFile(const std::string& filename, std::string& data){
+    std::error_code error;
+    uintmax_t size = std::filesystem::file_size(filename, error);
+    if(error == std::errc::no_such_file_or_directory)
+        return false;
+    std::ifstream ifs(filename, std::ios::binary);
+    if(!error){
+        data.resize(size);
+        ifs.read(data.data(), (std::streamsize)size);
+    }
+    if(error || !ifs)
+        throw std::runtime_error("Cannot read " + filename);
+    return true;
+}
+
+bool CJournal::read(std::string& checkpoint, std::vector<std::string>& records){
+    if(!readFile(filename_, checkpoint))
+        return false;
+    checkpoint_size_ = checkpoint.size();
+    checkpoint_crc_ = CCrc32c::of(checkpoint);
+    records.clear();
+    std::string journal;
+    readFile(journal_filename_, journal);
+    size_ = 0;
+    if(journal.compare(0, JOURNAL_HEADER_SIZE, header()) == 0){
+        size_ = JOURNAL_HEADER_SIZE;
+        while(journal.size() - size_ >= 8){
+            uint32_t size = CBinaryReader(std::string_view(journal).substr(size_, 4)).getUnsigned();
+            if(size == 0 || journal.size() - size_ - 8 < size)
+                break;
+            std::string_view payload = std::string_view(journal).substr(size_ + 4, size);
+            if(CBinaryReader(std::string_view(journal).substr(size_ + 4 + size, 4)).getUnsigned() != CCrc32c::of(payload))
+                break;
+            records.emplace_back(payload);
+            size_ += 8 + size;
+        }
+    }
+    if(size_ == 0){
+        startJournal();
+        return true;
+    }
+    std::error_code error;
+    if(size_ < journal.size())
+        std::filesystem::resize_file(journal_filename_, size_, error);
+    out_.open(journal_filename_, std::ios::binary | std::ios::app);
+    if(error || !out_)
+        throw std::runtime_error("Cannot write the journal " + journal_filename_);
+    return true;
+}
+
+//the journal is only started again once the checkpoint was replaced, so it stays valid if writing the checkpoint fails
+void CJournal::checkpoint(std::string_view data){
+    std::string temporary = filename_ + ".tmp";
+    std::ofstream ofs(temporary, std::ios::binary | std::ios::trunc);
+    ofs.write(data.data(), (std::streamsize)data.size());
+    ofs.close();
+    std::error_code error;
+    if(ofs)
+        std::filesystem::rename(temporary, filename_, error);
+    if(!ofs || error)
+        throw std::runtime_error("Cannot write the checkpoint " + filename_);
+    checkpoint_size_ = data.size();
+    checkpoint_crc_ = CCrc32c::of(data);
+    startJournal();
+}
+
+void CJournal::append(std::string_view record){
+    std::string frame;
+    frame.reserve(record.size() + 8);
+    CBinaryWriter writer(frame);
+    writer.putUnsigned((uint32_t)record.size());
+    writer.putBytes(record);
+    writer.putUnsigned(CCrc32c::of(record));
+    out_.write(frame.data(), (std::streamsize)frame.size());
+    out_.flush();
+    if(!out_)
+        throw std::runtime_error("Cannot write the journal " + journal_filename_);
+    size_ += frame.size();
+}
+
+std::string CJournal::header() const{
+    std::string header;
+    CBinaryWriter writer(header);
+    writer.putBytes(JOURNAL_MAGIC);
+    writer.putUnsigned(JOURNAL_VERSION);
+    writer.putUnsigned64(checkpoint_size_);
+    writer.putUnsigned(checkpoint_crc_);
+    return header;
+}
+
+//start an empty journal following the current checkpoint
+void CJournal::startJournal(){
+    out_.close();
+    out_.open(journal_filename_, std::ios::binary | std::ios::trunc);
+    std::string data = header();
+    out_.write(data.data(), (std::streamsize)data.size());
+    out_.flush();
+    if(!out_)
+        throw std::runtime_error("Cannot write the journal " + journal_filename_);
+    size_ = data.size();
+}
@@ -0,0 +1,66 @@
+#ifndef CJournal_h
+#define CJournal_h
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+//layout of the journal file
+//the header is JOURNAL_MAGIC, the version and the size and CRC-32C of the checkpoint the journal follows, then every
+//record is a frame of its size, its payload and its CRC-32C like a block of the binary format
+constexpr std::string_view JOURNAL_MAGIC = "FITJ";
+constexpr uint32_t JOURNAL_VERSION = 1;
+constexpr size_t JOURNAL_HEADER_SIZE = 20;
+//a journal is compacted into a checkpoint once it is larger than the checkpoint and than this size
+constexpr uint64_t JOURNAL_MIN_SIZE = 1u << 20;
+
+//checkpoint file of a spreadsheet and a journal of the records of the changes made after the checkpoint, which is
+//stored next to it in filename.journal
+//a record is appended and flushed before its change is made, so after a crash of the process the checkpoint and the
+//complete records of the journal hold every change that was made
+//a new checkpoint is written to a temporary file and renamed over the old one, then the journal is started again,
+//a journal whose header does not match the checkpoint is left from a compaction that was interrupted in between,
+//its changes are contained in the checkpoint already
+class CJournal {
+public:
+    CJournal(std::string filename, uint64_t min_size);
+
+    //read the checkpoint and the records of its journal, return false if the checkpoint file does not exist
+    //a record that is not complete or whose checksum does not match ends the journal, it was being appended when the
+    //process stopped, so the journal is truncated before it and the following records are appended in its place
+    //throw std::runtime_error if an existing checkpoint or journal cannot be read or the journal cannot be written
+    bool read(std::string& checkpoint, std::vector<std::string>& records);
+
+    //replace the checkpoint and start an empty journal after it, throw std::runtime_error if the files cannot be written
+    void checkpoint(std::string_view data);
+
+    //append a record and flush it, throw std::runtime_error if it cannot be written
+    void append(std::string_view record);
+
+    //return true if the journal should be compacted into a new checkpoint, the cost of writing a checkpoint is then
+    //amortized over at least as many bytes of records as it has
+    bool full() const{
+        return size_ > min_size_ && size_ > checkpoint_size_;
+    }
+
+    const std::string& filename() const{
+        return filename_;
+    }
+
+private:
+    std::string header() const;
+    void startJournal();
+
+    std::string filename_;
+    std::string journal_filename_;
+    uint64_t min_size_;
+    uint64_t checkpoint_size_ = 0;
+    uint32_t checkpoint_crc_ = 0;
+    uint64_t size_ = 0;
+    std::ofstream out_;
+};
+
+#endif /* CJournal_h */
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "CASTBuilder.h"
+#include "CCrc32c.h"
+#include "CGrid.h"
+#include "CLazyFile.h"
+
+//return the payload of the block starting at the offset and move the offset past the block
+//throw std::invalid_argument if the block does not lie within the data or its checksum does not match
+static std::string_view readBlock(std::string_view data, uint64_t& offset){
+    if(offset > data.size() || data.size() - offset < 8)
+        throw std::invalid_argument("Missing block");
+    uint32_t size = CBinaryReader(data.substr(offset, 4)).getUnsigned();
+    if(size == 0 || size > MAX_BINARY_BLOCK_SIZE || data.size() - offset - 8 < size)
+        throw std::invalid_argument("Invalid block size");
+    std::string_view payload = data.substr(offset + 4, size);
+    if(CBinaryReader(data.substr(offset + 4 + size, 4)).getUnsigned() != CCrc32c::of(payload))
+        throw std::invalid_argument("Damaged block");
+    offset += 8 + size;
+    return payload;
+}
+
+//reader of the records of a span, the blocks are read and verified as the records are decoded
+class CSpanReader {
+public:
+    CSpanReader(std::string_view data, const CBlockSpan& span) : offset_(span.offset){
+        if(span.offset > data.size() || span.size > data.size() - span.offset)
+            throw std::invalid_argument("Invalid span");
+        data_ = data.substr(0, span.offset + span.size);
+    }
+
+    CBinaryReader& next(){
+        while(reader_.atEnd())
+            reader_ = CBinaryReader(readBlock(data_, offset_));
+        return reader_;
+    }
+
+    bool atEnd() const{
+        return reader_.atEnd() && offset_ == data_.size();
+    }
+
+private:
+    std::string_view data_;
+    uint64_t offset_;
+    CBinaryReader reader_{std::string_view()};
+};
+
+std::shared_ptr<CLazyFile> CLazyFile::open(const std::string& filename){
+    std::shared_ptr<CLazyFile> file(new CLazyFile());
+    if(!file->map(filename))
+        return nullptr;
+    std::string_view data = file->data_;
+    try{
+        if(data.size() < BINARY_HEADER_SIZE + BINARY_FOOTER_SIZE)
+            return nullptr;
+        CBinaryReader header(data.substr(0, BINARY_HEADER_SIZE));
+        header.expect(BINARY_MAGIC);
+        uint32_t version = header.getUnsigned();
+        if(version < 3 || version > BINARY_VERSION)
+            return nullptr;
+        CBinaryReader footer(data.substr(data.size() - BINARY_FOOTER_SIZE));
+        uint64_t offset = footer.getUnsigned64();
+        footer.expect(INDEX_MAGIC);
+        std::string_view blocks = data.substr(0, data.size() - BINARY_FOOTER_SIZE);
+        CBinaryReader index(readBlock(blocks, offset));
+        file->index_ = CBinaryIndex::deserialize(index);
+        if(!index.atEnd() || offset != blocks.size())
+            return nullptr;
+        for(size_t i = 0; i < file->index_.tiles.size(); ++i)
+            if(!file->tile_spans_.emplace(file->index_.tiles[i].first, i).second)
+                return nullptr;
+        size_t formulas = 0;
+        if(!file->index_.formula_blocks.empty())
+            formulas = (size_t)file->index_.formula_blocks.back().first + file->index_.formula_blocks.back().count;
+        //every formula takes at least a few bytes, a larger count can only come from a damaged index
+        if(formulas > data.size())
+            return nullptr;
+        file->formulas_.resize(formulas);
+        file->ranges_.resize(formulas);
+    }
+    catch(std::invalid_argument&){
+        return nullptr;
+    }
+    file->builder_ = std::make_unique<CASTBuilder>();
+    return file;
+}
+
+bool CLazyFile::map(const std::string& filename){
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= 0){
+        ::close(fd);
+        return false;
+    }
+    void* mapping = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED){
+        ::close(fd);
+        return false;
+    }
+    fd_ = fd;
+    modified_ = (long long)st.st_mtime;
+    mapped_size_ = (size_t)st.st_size;
+    data_ = std::string_view((const char*)mapping, mapped_size_);
+#else
+    std::ifstream ifs(filename, std::ios::binary);
+    if(!ifs)
+        return false;
+    buffer_.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    data_ = buffer_;
+#endif
+    return true;
+}
+
+CLazyFile::~CLazyFile(){
+#if defined(__unix__) || defined(__APPLE__)
+    if(mapped_size_ > 0)
+        munmap((void*)data_.data(), mapped_size_);
+    if(fd_ >= 0)
+        ::close(fd_);
+#endif
+}
+
+//return true if the mapped file was truncated or rewritten since it was opened, a file read into memory is never
+//modified
+bool CLazyFile::modified() const{
+#if defined(__unix__) || defined(__APPLE__)
+    struct stat st;
+    if(fd_ >= 0)
+        return fstat(fd_, &st) != 0 || (size_t)st.st_size != mapped_size_ || (long long)st.st_mtime != modified_;
+#endif
+    return false;
+}
+
+std::vector<uint64_t> CLazyFile::tiles() const{
+    std::vector<uint64_t> keys;
+    keys.reserve(index_.tiles.size());
+    for(const auto& tile : index_.tiles)
+        keys.push_back(tile.first);
+    return keys;
+}
+
+//the cells are decoded into a separate vector, so a damaged tile is not decoded partially
+std::vector<std::pair<CPos, CCell>> CLazyFile::decodeTile(uint64_t key){
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = tile_spans_.find(key);
+    if(it == tile_spans_.end())
+        return {};
+    if(modified())
+        throw std::runtime_error("The lazily loaded file was modified");
+    const CBlockSpan& span = index_.tiles[it->second].second;
+    std::vector<std::pair<CPos, CCell>> cells;
+    try{
+        CSpanReader reader(data_, span);
+        for(uint32_t i = 0; i < span.count; ++i){
+            CCell cell;
+            uint32_t index;
+            CPos pos = decodeCell(reader.next(), cell, index);
+            if(CGrid<CCell>::tileKey(pos) != key)
+                throw std::invalid_argument("Cell outside of its tile");
+            if(index != NO_FORMULA){
+                if(index >= formulas_.size())
+                    throw std::invalid_argument("Invalid formula");
+                if(!formulas_[index]){
+                    auto span_it = std::upper_bound(index_.formula_blocks.begin(), index_.formula_blocks.end(), index,
+                                                    [](uint32_t i, const CBlockSpan& s){ return i < s.first; });
+                    decodeFormulas(*(span_it - 1));
+                }
+                if(!ranges_[index].fits(cell.col_shift, cell.row_shift))
+                    throw std::invalid_argument("Invalid offset");
+                cell.formula = formulas_[index];
+            }
+            cells.emplace_back(pos, std::move(cell));
+        }
+        if(!reader.atEnd())
+            throw std::invalid_argument("Unexpected data");
+    }
+    catch(std::invalid_argument& e){
+        throw std::runtime_error(std::string("Damaged tile of a lazily loaded file: ") + e.what());
+    }
+    return cells;
+}
+
+//decode all formulas of the span, the first span starts with the number of formulas, the last one ends with
+//the number of cells, which are both skipped
+void CLazyFile::decodeFormulas(const CBlockSpan& span){
+    CSpanReader reader(data_, span);
+    if(span.first == 0)
+        reader.next().getUnsigned();
+    std::vector<std::shared_ptr<const CFormula>> formulas;
+    std::vector<CReferenceRange> ranges(span.count);
+    for(uint32_t i = 0; i < span.count; ++i){
+        const CNode* ast = decodeFormula(reader.next(), *builder_, ranges[i]);
+        formulas.push_back(std::make_shared<const CFormula>(ast, builder_->arena()));
+    }
+    for(uint32_t i = 0; i < span.count; ++i){
+        formulas_[span.first + i] = std::move(formulas[i]);
+        ranges_[span.first + i] = ranges[i];
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef CLazyFile_h
+#define CLazyFile_h
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "CBinaryFormat.h"
+
+class CASTBuilder;
+
+
+//binary file of version 3 mapped into memory for a lazily loaded spreadsheet
+//opening the file reads only its header and its index, the cells of a tile are decoded when the spreadsheet first
+//needs them and the formulas when a decoded cell first refers to them, the blocks are verified as they are decoded
+//decoding is synchronized, so copies of a spreadsheet used on different threads may share the file
+//the file should not be modified as long as it is mapped, a tile is not decoded from a file whose size or time of
+//modification changed since it was opened, as the mapping may then end before the file it was opened with
+class CLazyFile {
+public:
+    //map the file and read its index, return nullptr if it is not a binary file with an index or it is damaged
+    static std::shared_ptr<CLazyFile> open(const std::string& filename);
+
+    CLazyFile(const CLazyFile& src) = delete;
+    CLazyFile& operator =(const CLazyFile& other) = delete;
+    ~CLazyFile();
+
+    //keys of all tiles stored in the file
+    std::vector<uint64_t> tiles() const;
+
+    //decode all cells of the tile, throw std::runtime_error if the file is damaged or it was modified
+    std::vector<std::pair<CPos, CCell>> decodeTile(uint64_t key);
+
+private:
+    CLazyFile() = default;
+    bool map(const std::string& filename);
+    bool modified() const;
+    void decodeFormulas(const CBlockSpan& span);
+
+    //contents of the file, mapped into memory if the platform supports it
+    std::string_view data_;
+    std::string buffer_;
+    size_t mapped_size_ = 0;
+    //the mapped file stays open, so it is checked for modifications before it is read
+    int fd_ = -1;
+    long long modified_ = 0;
+    CBinaryIndex index_;
+    std::unordered_map<uint64_t, size_t> tile_spans_;
+
+    std::mutex mutex_;
+    std::unique_ptr<CASTBuilder> builder_;
+    //decoded formulas and the ranges of their references, a formula is nullptr until its span is decoded
+    std::vector<std::shared_ptr<const CFormula>> formulas_;
+    std::vector<CReferenceRange> ranges_;
+};
+
+#endif /* CLazyFile_h */
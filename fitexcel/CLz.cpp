@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "CLz.h"
+
+//the hash table keeps the last position of every hash of 4 bytes
+static constexpr int HASH_BITS = 14;
+
+static uint32_t load32(const char* p){
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static size_t hash32(uint32_t value){
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+//append a length that did not fit into its 4 bits of the token
+static void putLength(std::string& out, size_t length){
+    for(; length >= 255; length -= 255)
+        out.push_back((char)255);
+    out.push_back((char)length);
+}
+
+//append a run of literals followed by a match, a match of length 0 ends the data
+static void putRun(std::string& out, std::string_view literals, size_t distance, size_t match){
+    size_t match_code = match > 0 ? match - LZ_MIN_MATCH : 0;
+    out.push_back((char)((std::min<size_t>(literals.size(), 15) << 4) | std::min<size_t>(match_code, 15)));
+    if(literals.size() >= 15)
+        putLength(out, literals.size() - 15);
+    out.append(literals);
+    if(match == 0)
+        return;
+    out.push_back((char)(distance & 0xff));
+    out.push_back((char)(distance >> 8));
+    if(match_code >= 15)
+        putLength(out, match_code - 15);
+}
+
+//a greedy search for the matches through the hash table, in data without matches the search skips ahead faster
+//the longer it finds none
+void lzCompress(std::string_view data, std::string& out){
+    const char* p = data.data();
+    size_t size = data.size();
+    //positions are stored increased by one, so 0 is an empty slot
+    std::vector<uint32_t> table(1u << HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t pos = 0;
+    while(pos + LZ_MIN_MATCH <= size){
+        uint32_t sequence = load32(p + pos);
+        uint32_t& slot = table[hash32(sequence)];
+        size_t candidate = slot;
+        slot = (uint32_t)pos + 1;
+        if(candidate == 0 || pos + 1 - candidate > LZ_MAX_DISTANCE || load32(p + candidate - 1) != sequence){
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+        --candidate;
+        size_t match = LZ_MIN_MATCH;
+        while(pos + match < size && p[candidate + match] == p[pos + match])
+            ++match;
+        putRun(out, data.substr(anchor, pos - anchor), pos - candidate, match);
+        pos += match;
+        anchor = pos;
+        //the position just before the end of the match is likely to start the next match
+        if(pos >= 2 && pos - 2 + LZ_MIN_MATCH <= size)
+            table[hash32(load32(p + pos - 2))] = (uint32_t)(pos - 2) + 1;
+    }
+    putRun(out, data.substr(anchor), 0, 0);
+}
+
+//read a length that continues after its 4 bits of the token
+static bool getLength(std::string_view data, size_t& in, size_t& length){
+    unsigned char byte;
+    do{
+        if(in >= data.size())
+            return false;
+        byte = (unsigned char)data[in++];
+        length += byte;
+    }while(byte == 255);
+    return true;
+}
+
+bool lzDecompress(std::string_view data, size_t size, std::string& out){
+    out.resize(size);
+    char* o = out.data();
+    size_t in = 0, pos = 0;
+    while(in < data.size()){
+        unsigned char token = (unsigned char)data[in++];
+        size_t literals = token >> 4;
+        if(literals == 15 && !getLength(data, in, literals))
+            return false;
+        if(literals > data.size() - in || literals > size - pos)
+            return false;
+        std::memcpy(o + pos, data.data() + in, literals);
+        in += literals;
+        pos += literals;
+        //the last run has no match, so its token has no length of a match either
+        if(in == data.size())
+            return pos == size && (token & 15) == 0;
+        if(data.size() - in < 2)
+            return false;
+        size_t distance = (unsigned char)data[in] | (size_t)(unsigned char)data[in + 1] << 8;
+        in += 2;
+        size_t match = token & 15;
+        if(match == 15 && !getLength(data, in, match))
+            return false;
+        match += LZ_MIN_MATCH;
+        if(distance == 0 || distance > pos || match > size - pos)
+            return false;
+        //a match may overlap the bytes it produces, which repeats them
+        if(distance >= match)
+            std::memcpy(o + pos, o + pos - distance, match);
+        else
+            for(size_t i = 0; i < match; ++i)
+                o[pos + i] = o[pos + i - distance];
+        pos += match;
+    }
+    return false;
+}
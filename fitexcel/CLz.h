@@ -0,0 +1,24 @@
+#ifndef CLz_h
+#define CLz_h
+
+#include <string>
+#include <string_view>
+
+
+//block compressor of the compressed save format in the style of LZ4, it has no dependencies
+//the compressed data is a sequence of literal runs, each followed by a match copying bytes that were already
+//decompressed, the last run has no match
+//every run starts with a token, whose high 4 bits are the number of literals and low 4 bits the length of the match
+//minus LZ_MIN_MATCH, a value of 15 continues in the following bytes, which are added to it until one is not 255,
+//the literals follow, then the 2-byte distance of the match and the bytes continuing its length
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr size_t LZ_MAX_DISTANCE = 65535;
+
+//compress the data and append it to out
+void lzCompress(std::string_view data, std::string& out);
+
+//decompress the data into out, which is resized to size, the size of the data before it was compressed
+//return false if the data is not valid, it never reads or writes outside of the buffers
+bool lzDecompress(std::string_view data, size_t size, std::string& out);
+
+#endif /* CLz_h */
@@ -1,4 +1,7 @@
 
+#ifndef CNode_h
+#define CNode_h
+
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
@@ -32,60 +35,89 @@
 #include <charconv>
 #include <span>
 #include <utility>
-#include "CPos.h"
-
-using CValue = std::variant<std::monostate, double, std::string>;
+#include "CArena.h"
+#include "CProgram.h"
 
 //abstract class representing a node in the AST
+//nodes are allocated in an arena, which owns them, so a node does not own its children and is never deleted
 struct CNode {
+    //nodes holding no resources are not destroyed by the arena
+    static constexpr bool OWNS_MEMORY = false;
+
+
     //recursively traverse the AST and return the value of the expression it represents
-    //this function is only called if the AST contains no cycles
-    virtual CValue evaluate([[maybe_unused]]std::map<CPos, CNode*>& cells) const = 0;
+    //values of referenced cells are requested from the evaluator
+    virtual CValue evaluate(CEvaluator& ev) const = 0;
 
-    virtual CNode* clone() const = 0;
+    //create a deep copy of the tree in the arena
+    virtual CNode* clone(CArena& arena) const = 0;
 
     virtual ~CNode() = default;
 
-    //if the node this is called on represents a cell reference, shift its coordinates that are not absolute references
-    virtual void shift_references([[maybe_unused]]int w, [[maybe_unused]]int h){}
+    //precedence levels of the expressions in the grammar of the parser, from the loosest to the tightest binding
+    enum CPrecedence {
+        EQUALITY,
+        RELATION,
+        SUM,
+        PRODUCT,
+        UNARY,
+        POWER,
+        PRIMARY
+    };
+
+    //recursively traverse the AST and append the expression it represents to out, it is parsed back to the same AST
+    //an operand is enclosed in parentheses only if its precedence is lower than the one its operator requires,
+    //references that are not absolute are shifted by w columns and h rows
+    virtual void write(std::string& out, int w, int h) const = 0;
+
+    //precedence of the expression written by write
+    virtual CPrecedence precedence() const{ return PRIMARY; }
+
+    //write the expression as an operand requiring the given precedence
+    void writeOperand(std::string& out, int w, int h, CPrecedence required) const{
+        if(precedence() >= required)
+            return write(out, w, h);
+        out.push_back('(');
+        write(out, w, h);
+        out.push_back(')');
+    }
+
+    //reconstruct the string containing the expression represented by the AST
+    std::string reconstruct(int w, int h) const{
+        std::string res;
+        write(res, w, h);
+        return res;
+    }
+
+    //append the instructions evaluating the expression to the program in postfix order
+    virtual void compile(CProgram& program) const = 0;
 
-    //recursively traverse the AST and reconstruct the original string containing the expression represented by the AST
-    virtual std::string reconstruct() const = 0;
+    //return true if the node is a literal, whose value does not depend on any cell
+    virtual bool constant() const{ return false; }
 
-    //DFS helper function for detecting cycles
-    //if a back edge is detected, the AST contains a cycle, return true
-    virtual bool hasCycle([[maybe_unused]]std::set<CNode*>& visited, [[maybe_unused]]std::set<CNode*> rec_stack, [[maybe_unused]]const std::map<CPos, CNode*>& cells) const{ return false; }
+    //return true if the expression always results in a number or an empty value, but never in a string
+    virtual bool numeric() const{ return false; }
 };
 
 struct BinaryOpNode : public CNode{
     BinaryOpNode(CNode* left, CNode* right) : left_(left), right_(right) {}
-    BinaryOpNode(const BinaryOpNode& src){
-        left_ = src.left_->clone();
-        right_ = src.right_->clone();
-    }
-    ~BinaryOpNode() override{
-        delete left_;
-        delete right_;
-    }
-    BinaryOpNode& operator =(const BinaryOpNode& other){
-        if(this == &other)
-            return *this;
-        delete left_;
-        delete right_;
-        left_ = other.left_->clone();
-        right_ = other.right_->clone();
-        return *this;
-    }
-    virtual void shift_references(int w, int h) override{
-        left_->shift_references(w, h);
-        right_->shift_references(w, h);
-    }
-    virtual bool hasCycle(std::set<CNode*>& visited, std::set<CNode*> rec_stack, const std::map<CPos, CNode*>& cells) const override{
-        if(!rec_stack.insert((CNode*)this).second)
-            return true;
-        if(!visited.insert((CNode*)this).second)
-            return false;
-        return left_->hasCycle(visited, rec_stack, cells) || right_->hasCycle(visited, rec_stack, cells);
+    void compile(CProgram& program) const override{
+        left_->compile(program);
+        right_->compile(program);
+        program.emitOperation(op());
+    }
+    //operation performed by the node in the compiled program
+    virtual CProgram::COp op() const = 0;
+    //symbol of the operator in the expression
+    virtual std::string_view symbol() const = 0;
+    //all binary operators associate to the left, so the right operand of the same precedence needs parentheses
+    void write(std::string& out, int w, int h) const override{
+        left_->writeOperand(out, w, h, precedence());
+        out += symbol();
+        right_->writeOperand(out, w, h, (CPrecedence)(precedence() + 1));
+    }
+    bool numeric() const override{
+        return true;
     }
 
     CNode* left_;
@@ -94,296 +126,326 @@ struct BinaryOpNode : public CNode{
 
 struct AddNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
-            return std::get<double>(left) + std::get<double>(right);
-        if(std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right)){
-            return std::get<std::string>(left) + std::get<std::string>(right);
-        }
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Add;
+    }
+    bool numeric() const override{
+        return false;
     }
-    CNode* clone() const override{
-        return new AddNode(*this);
+    CValue evaluate(CEvaluator& ev) const override{
+        return addValues(left_->evaluate(ev), right_->evaluate(ev));
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "+" + right_->reconstruct() + ")";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<AddNode>(left_->clone(arena), right_->clone(arena));
+    }
+    std::string_view symbol() const override{
+        return "+";
+    }
+    CPrecedence precedence() const override{
+        return SUM;
     }
 };
 
 struct SubNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
-            return std::get<double>(left) - std::get<double>(right);
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Sub;
+    }
+    CValue evaluate(CEvaluator& ev) const override{
+        return subValues(left_->evaluate(ev), right_->evaluate(ev));
+    }
+    CNode* clone(CArena& arena) const override{
+        return arena.make<SubNode>(left_->clone(arena), right_->clone(arena));
     }
-    CNode* clone() const override{
-        return new SubNode(*this);
+    std::string_view symbol() const override{
+        return "-";
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "-" + right_->reconstruct() + ")";
+    CPrecedence precedence() const override{
+        return SUM;
     }
 };
 
 struct MulNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
-            return std::get<double>(left) * std::get<double>(right);
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Mul;
     }
-    CNode* clone() const override{
-        return new MulNode(*this);
+    CValue evaluate(CEvaluator& ev) const override{
+        return mulValues(left_->evaluate(ev), right_->evaluate(ev));
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "*" + right_->reconstruct() + ")";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<MulNode>(left_->clone(arena), right_->clone(arena));
+    }
+    std::string_view symbol() const override{
+        return "*";
+    }
+    CPrecedence precedence() const override{
+        return PRODUCT;
     }
 };
 
 struct DivNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right) && std::get<double>(right) != 0)
-            return std::get<double>(left) / std::get<double>(right);
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Div;
+    }
+    CValue evaluate(CEvaluator& ev) const override{
+        return divValues(left_->evaluate(ev), right_->evaluate(ev));
+    }
+    CNode* clone(CArena& arena) const override{
+        return arena.make<DivNode>(left_->clone(arena), right_->clone(arena));
     }
-    CNode* clone() const override{
-        return new DivNode(*this);
+    std::string_view symbol() const override{
+        return "/";
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "/" + right_->reconstruct() + ")";
+    CPrecedence precedence() const override{
+        return PRODUCT;
     }
 };
 
 struct PowNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
-            return pow(std::get<double>(left), std::get<double>(right));
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Pow;
     }
-    CNode* clone() const override{
-        return new PowNode(*this);
+    CValue evaluate(CEvaluator& ev) const override{
+        return powValues(left_->evaluate(ev), right_->evaluate(ev));
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "^" + right_->reconstruct() + ")";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<PowNode>(left_->clone(arena), right_->clone(arena));
+    }
+    std::string_view symbol() const override{
+        return "^";
+    }
+    CPrecedence precedence() const override{
+        return POWER;
     }
 };
 
 struct EqNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        return (left == right) * 1.0;
+    CProgram::COp op() const override{
+        return CProgram::COp::Eq;
+    }
+    CValue evaluate(CEvaluator& ev) const override{
+        return eqValues(left_->evaluate(ev), right_->evaluate(ev));
+    }
+    CNode* clone(CArena& arena) const override{
+        return arena.make<EqNode>(left_->clone(arena), right_->clone(arena));
     }
-    CNode* clone() const override{
-        return new EqNode(*this);
+    std::string_view symbol() const override{
+        return "=";
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "=" + right_->reconstruct() + ")";
+    CPrecedence precedence() const override{
+        return EQUALITY;
     }
 };
 
 struct NeNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        return (left != right) * 1.0;
+    CProgram::COp op() const override{
+        return CProgram::COp::Ne;
     }
-    CNode* clone() const override{
-        return new NeNode(*this);
+    CValue evaluate(CEvaluator& ev) const override{
+        return neValues(left_->evaluate(ev), right_->evaluate(ev));
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "<>" + right_->reconstruct() + ")";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<NeNode>(left_->clone(arena), right_->clone(arena));
+    }
+    std::string_view symbol() const override{
+        return "<>";
+    }
+    CPrecedence precedence() const override{
+        return EQUALITY;
     }
 };
 
 struct LtNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) {
-            return (std::get<double>(left) < std::get<double>(right)) * 1.0;
-        }
-        if(std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right)){
-            return (std::get<std::string>(left) < std::get<std::string>(right)) * 1.0;
-        }
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Lt;
     }
-    CNode* clone() const override{
-        return new LtNode(*this);
+    CValue evaluate(CEvaluator& ev) const override{
+        return ltValues(left_->evaluate(ev), right_->evaluate(ev));
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "<" + right_->reconstruct() + ")";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<LtNode>(left_->clone(arena), right_->clone(arena));
+    }
+    std::string_view symbol() const override{
+        return "<";
+    }
+    CPrecedence precedence() const override{
+        return RELATION;
     }
 };
 
 struct LeNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) {
-            return (std::get<double>(left) <= std::get<double>(right)) * 1.0;
-        }
-        if(std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right)){
-            return (std::get<std::string>(left) <= std::get<std::string>(right)) * 1.0;
-        }
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Le;
     }
-    CNode* clone() const override{
-        return new LeNode(*this);
+    CValue evaluate(CEvaluator& ev) const override{
+        return leValues(left_->evaluate(ev), right_->evaluate(ev));
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + "<=" + right_->reconstruct() + ")";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<LeNode>(left_->clone(arena), right_->clone(arena));
+    }
+    std::string_view symbol() const override{
+        return "<=";
+    }
+    CPrecedence precedence() const override{
+        return RELATION;
     }
 };
 
 struct GtNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) {
-            return (std::get<double>(left) > std::get<double>(right)) * 1.0;
-        }
-        if(std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right)){
-            return (std::get<std::string>(left) > std::get<std::string>(right)) * 1.0;
-        }
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Gt;
     }
-    CNode* clone() const override{
-        return new GtNode(*this);
+    CValue evaluate(CEvaluator& ev) const override{
+        return gtValues(left_->evaluate(ev), right_->evaluate(ev));
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + ">" + right_->reconstruct() + ")";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<GtNode>(left_->clone(arena), right_->clone(arena));
+    }
+    std::string_view symbol() const override{
+        return ">";
+    }
+    CPrecedence precedence() const override{
+        return RELATION;
     }
 };
 
 struct GeNode : public BinaryOpNode{
     using BinaryOpNode::BinaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue left = left_->evaluate(cells);
-        CValue right = right_->evaluate(cells);
-        if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) {
-            return (std::get<double>(left) >= std::get<double>(right)) * 1.0;
-        }
-        if(std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right)){
-            return (std::get<std::string>(left) >= std::get<std::string>(right)) * 1.0;
-        }
-        return CValue();
+    CProgram::COp op() const override{
+        return CProgram::COp::Ge;
     }
-    CNode* clone() const override{
-        return new GeNode(*this);
+    CValue evaluate(CEvaluator& ev) const override{
+        return geValues(left_->evaluate(ev), right_->evaluate(ev));
     }
-    std::string reconstruct() const override{
-        return "(" + left_->reconstruct() + ">=" + right_->reconstruct() + ")";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<GeNode>(left_->clone(arena), right_->clone(arena));
+    }
+    std::string_view symbol() const override{
+        return ">=";
+    }
+    CPrecedence precedence() const override{
+        return RELATION;
     }
 };
 
 struct UnaryOpNode : public CNode{
     UnaryOpNode(CNode* child) : child_(child) {}
-    UnaryOpNode(const UnaryOpNode& src){
-        child_ = src.child_->clone();
-    }
-    ~UnaryOpNode() override{
-        delete child_;
-    }
-    UnaryOpNode& operator =(const UnaryOpNode& other){
-        if(this == &other)
-            return *this;
-        delete child_;
-        child_ = other.child_->clone();
-        return *this;
-    }
-    virtual void shift_references(int w, int h) override{
-        child_->shift_references(w, h);
-    }
-    virtual bool hasCycle(std::set<CNode*>& visited, std::set<CNode*> rec_stack, const std::map<CPos, CNode*>& cells) const override{
-        if(!rec_stack.insert((CNode*)this).second)
-            return true;
-        if(!visited.insert((CNode*)this).second)
-            return false;
-        return child_->hasCycle(visited, rec_stack, cells);
-    }
 
     CNode* child_;
 };
 
 struct NegNode : public UnaryOpNode{
     using UnaryOpNode::UnaryOpNode;
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CValue child = child_->evaluate(cells);
-        if(std::holds_alternative<double>(child))
-            return -std::get<double>(child);
-        return CValue();
+    CValue evaluate(CEvaluator& ev) const override{
+        return negValue(child_->evaluate(ev));
+    }
+    CNode* clone(CArena& arena) const override{
+        return arena.make<NegNode>(child_->clone(arena));
     }
-    CNode* clone() const override{
-        return new NegNode(*this);
+    void compile(CProgram& program) const override{
+        child_->compile(program);
+        program.emitOperation(CProgram::COp::Neg);
     }
-    std::string reconstruct() const override{
-        return "(-" + child_->reconstruct() + ")";
+    bool numeric() const override{
+        return true;
+    }
+    CPrecedence precedence() const override{
+        return UNARY;
+    }
+    void write(std::string& out, int w, int h) const override{
+        out.push_back('-');
+        child_->writeOperand(out, w, h, UNARY);
     }
 };
 
+//append the shortest representation of the number that is parsed back to the same value, so even numbers computed
+//by constant folding are saved exactly, an infinity is written as a number out of the range of double
+inline void writeNumber(std::string& out, double num){
+    if(std::isinf(num)){
+        out.append(num < 0 ? "-1e999" : "1e999");
+        return;
+    }
+    char buffer[32];
+    out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), num).ptr);
+}
+
+//append the string with the quotes that were undoubled by the parser doubled again
+inline void writeStringContents(std::string& out, std::string_view str){
+    for(size_t quote; (quote = str.find('\"')) != std::string_view::npos; str.remove_prefix(quote + 1)){
+        out.append(str.substr(0, quote + 1));
+        out.push_back('\"');
+    }
+    out.append(str);
+}
+
+//append the string wrapped in quotes, so that it will be correctly parsed again later
+inline void writeString(std::string& out, std::string_view str){
+    out.push_back('\"');
+    writeStringContents(out, str);
+    out.push_back('\"');
+}
+
 struct ValNrNode : public CNode{
     ValNrNode(double d) : num_(d) {}
-    CValue evaluate([[maybe_unused]]std::map<CPos, CNode*>& cells) const override{
+    CValue evaluate([[maybe_unused]]CEvaluator& ev) const override{
         return num_;
     }
-    CNode* clone() const override{
-        return new ValNrNode(*this);
+    CNode* clone(CArena& arena) const override{
+        return arena.make<ValNrNode>(*this);
     }
-    //return the stored number with 15 decimal points precision
-    std::string reconstruct() const override{
-        std::stringstream ss;
-        ss << std::scientific << std::setprecision(15) << num_;
-        return ss.str();
-
-        //return std::to_string(num_);
+    void compile(CProgram& program) const override{
+        program.emitNumber(num_);
+    }
+    bool constant() const override{
+        return true;
+    }
+    bool numeric() const override{
+        return true;
+    }
+    //a negative number is written with its sign, which is parsed as a unary minus
+    CPrecedence precedence() const override{
+        return std::signbit(num_) ? UNARY : PRIMARY;
+    }
+    void write(std::string& out, [[maybe_unused]]int w, [[maybe_unused]]int h) const override{
+        writeNumber(out, num_);
     }
 
     double num_;
 };
 
 struct ValStrNode : public CNode{
-    ValStrNode(const std::string& str) : str_(str) {}
-    CValue evaluate([[maybe_unused]]std::map<CPos, CNode*>& cells) const override{
+    static constexpr bool OWNS_MEMORY = true;
+
+    ValStrNode(std::string_view str) : str_(str) {}
+    CValue evaluate([[maybe_unused]]CEvaluator& ev) const override{
         return str_;
     }
-    CNode* clone() const override{
-        return new ValStrNode(*this);
-    }
-    //double the quotes that were undoubled by the parser and wrap the string in quotes, so that it will be correctly
-    //parsed again later
-    std::string reconstruct() const override{
-        std::string res = "\"";
-        for(char c : str_){
-            if(c != '\"')
-                res.push_back(c);
-            else
-                res += "\"\"";
-        }
-        return res + "\"";
+    CNode* clone(CArena& arena) const override{
+        return arena.make<ValStrNode>(*this);
+    }
+    void compile(CProgram& program) const override{
+        program.emitString(str_);
+    }
+    bool constant() const override{
+        return true;
+    }
+    void write(std::string& out, [[maybe_unused]]int w, [[maybe_unused]]int h) const override{
+        writeString(out, str_);
     }
 
     std::string str_;
 };
 
 struct ValRefNode : public CNode{
+    ValRefNode(int col, int row, bool col_abs, bool row_abs) : col_(col), row_(row), col_abs_(col_abs), row_abs_(row_abs) {}
     ValRefNode(const std::string& str){
         size_t idx = 0;
         char c = 'a';
@@ -410,41 +472,23 @@ struct ValRefNode : public CNode{
         col_ = getInt(col);
         row_ = std::atoi(&(str[idx]));
     }
-    void shift_references(int w, int h) override{
-        if(!col_abs_)
-            col_ += w;
-        if(!row_abs_)
-            row_ += h;
+    CValue evaluate(CEvaluator& ev) const override{
+        return ev.valueAt(CPos(col_, row_));
     }
-    CValue evaluate(std::map<CPos, CNode*>& cells) const override{
-        CPos pos(col_, row_);
-        auto it = cells.find(pos);
-        if(it == cells.end() || it->second == nullptr)
-            return CValue();
-        return it->second->evaluate(cells);
+    CNode* clone(CArena& arena) const override{
+        return arena.make<ValRefNode>(*this);
     }
-    CNode* clone() const override{
-        return new ValRefNode(*this);
+    void compile(CProgram& program) const override{
+        program.emitReference(col_, row_, col_abs_, row_abs_);
     }
-    std::string reconstruct() const override{
-        std::string res;
+    void write(std::string& out, int w, int h) const override{
         if(col_abs_)
-            res.push_back('$');
-        res += getString(col_);
+            out.push_back('$');
+        writeColumn(out, col_abs_ ? col_ : col_ + w);
         if(row_abs_)
-            res.push_back('$');
-        res += std::to_string(row_);
-        return res;
-    }
-    virtual bool hasCycle(std::set<CNode*>& visited, std::set<CNode*> rec_stack, const std::map<CPos, CNode*>& cells) const override{
-        if(!rec_stack.insert((CNode*)this).second)
-            return true;
-        if(!visited.insert((CNode*)this).second)
-            return false;
-        auto it = cells.find(CPos(col_, row_));
-        if(it == cells.end() || !it->second)
-            return false;
-        return it->second->hasCycle(visited, rec_stack, cells);
+            out.push_back('$');
+        char buffer[16];
+        out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), row_abs_ ? row_ : row_ + h).ptr);
     }
 
     int col_ = 0;
@@ -453,3 +497,4 @@ struct ValRefNode : public CNode{
     bool row_abs_ = false;
 };
 
+#endif /* CNode_h */
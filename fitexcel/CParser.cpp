@@ -0,0 +1,259 @@
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include "CASTBuilder.h"
+#include "CParser.h"
+
+static bool isDigit(char c){
+    return c >= '0' && c <= '9';
+}
+
+void CParser::parse(){
+    if(!contents_.empty() && contents_[0] == '='){
+        pos_ = 1;
+        parseEquality();
+        if(next() != '\0' || pos_ != contents_.size())
+            fail("Unexpected extra token(s)");
+        return;
+    }
+    double number;
+    if(literalNumber(contents_, number))
+        builder_.valNumber(number);
+    else
+        builder_.valString(contents_);
+}
+
+//a literal is a number if it is an optionally negative number followed only by spaces
+bool CParser::literalNumber(std::string_view contents, double& number){
+    bool negative = !contents.empty() && contents[0] == '-';
+    size_t pos = negative;
+    if(pos == contents.size() || !isDigit(contents[pos]) || !scanNumber(contents, pos, number))
+        return false;
+    while(pos < contents.size() && std::isspace((unsigned char)contents[pos]))
+        ++pos;
+    if(pos != contents.size())
+        return false;
+    if(negative)
+        number = -number;
+    return true;
+}
+
+void CParser::parseEquality(){
+    parseRelation();
+    while(true){
+        char c = next();
+        if(c == '='){
+            ++pos_;
+            parseRelation();
+            builder_.opEq();
+        }
+        else if(c == '<' && lookahead() == '>'){
+            pos_ += 2;
+            parseRelation();
+            builder_.opNe();
+        }
+        else
+            return;
+    }
+}
+
+//<> is left to the equality, it is not a less than followed by a greater than
+void CParser::parseRelation(){
+    parseSum();
+    while(true){
+        char c = next();
+        if(c != '<' && c != '>')
+            return;
+        char d = lookahead();
+        if(c == '<' && d == '>')
+            return;
+        pos_ += d == '=' ? 2 : 1;
+        parseSum();
+        if(c == '<' && d == '=')
+            builder_.opLe();
+        else if(c == '<')
+            builder_.opLt();
+        else if(d == '=')
+            builder_.opGe();
+        else
+            builder_.opGt();
+    }
+}
+
+void CParser::parseSum(){
+    parseProduct();
+    while(true){
+        char c = next();
+        if(c != '+' && c != '-')
+            return;
+        ++pos_;
+        parseProduct();
+        if(c == '+')
+            builder_.opAdd();
+        else
+            builder_.opSub();
+    }
+}
+
+void CParser::parseProduct(){
+    parseUnary();
+    while(true){
+        char c = next();
+        if(c != '*' && c != '/')
+            return;
+        ++pos_;
+        parseUnary();
+        if(c == '*')
+            builder_.opMul();
+        else
+            builder_.opDiv();
+    }
+}
+
+//unary minus binds weaker than the power, so -2^2 is -(2^2)
+void CParser::parseUnary(){
+    if(next() == '-'){
+        ++pos_;
+        CNesting nesting(*this);
+        parseUnary();
+        builder_.opNeg();
+        return;
+    }
+    parsePower();
+}
+
+void CParser::parsePower(){
+    parsePrimary();
+    while(next() == '^'){
+        ++pos_;
+        parsePrimary();
+        builder_.opPow();
+    }
+}
+
+void CParser::parsePrimary(){
+    char c = next();
+    if(c == '\0')
+        fail("Unexpected token <EOF>");
+    if(isDigit(c)){
+        double number;
+        if(!scanNumber(contents_, pos_, number))
+            fail("Invalid number");
+        builder_.valNumber(number);
+    }
+    else if(c == '\"')
+        parseString();
+    else if(c == '$' || std::isalpha((unsigned char)c))
+        parseReference();
+    else if(c == '('){
+        ++pos_;
+        CNesting nesting(*this);
+        parseEquality();
+        if(next() != ')')
+            fail("Missing )");
+        ++pos_;
+    }
+    else
+        fail("Unexpected token");
+}
+
+//a quote inside of a string literal is written as two quotes
+void CParser::parseString(){
+    size_t begin = ++pos_;
+    bool escaped = false;
+    while(true){
+        size_t end = contents_.find('\"', pos_);
+        if(end == std::string_view::npos)
+            fail("Missing string terminator");
+        pos_ = end + 1;
+        if(pos_ == contents_.size() || contents_[pos_] != '\"')
+            break;
+        escaped = true;
+        ++pos_;
+    }
+    std::string_view str = contents_.substr(begin, pos_ - 1 - begin);
+    if(!escaped){
+        builder_.valString(str);
+        return;
+    }
+    buffer_.clear();
+    for(size_t i = 0; i < str.size(); ++i){
+        buffer_.push_back(str[i]);
+        if(str[i] == '\"')
+            ++i;
+    }
+    builder_.valString(buffer_);
+}
+
+//a reference is a column of uppercase letters and a row number, each of them optionally preceded by $
+//a relative row must not have leading zeros, functions and ranges are not supported
+void CParser::parseReference(){
+    //the longest column that fits into an int has 6 letters
+    constexpr size_t MAX_COLUMN_LENGTH = 6;
+    bool col_abs = contents_[pos_] == '$';
+    pos_ += col_abs;
+    size_t begin = pos_;
+    int col = 0;
+    for(; pos_ < contents_.size() && contents_[pos_] >= 'A' && contents_[pos_] <= 'Z'; ++pos_)
+        col = col * 26 + (contents_[pos_] - 'A' + 1);
+    if(pos_ == begin)
+        fail("Missing column id");
+    if(pos_ - begin > MAX_COLUMN_LENGTH)
+        fail("Invalid cell");
+    bool row_abs = pos_ < contents_.size() && contents_[pos_] == '$';
+    pos_ += row_abs;
+    begin = pos_;
+    while(pos_ < contents_.size() && isDigit(contents_[pos_]))
+        ++pos_;
+    if(pos_ == begin)
+        fail("Missing cell row");
+    int row;
+    if(std::from_chars(contents_.data() + begin, contents_.data() + pos_, row).ec != std::errc()
+            || (!row_abs && contents_[begin] == '0' && pos_ - begin > 1))
+        fail("Invalid cell");
+    if(pos_ < contents_.size() && (std::isalnum((unsigned char)contents_[pos_]) || contents_[pos_] == '$'
+            || contents_[pos_] == ':' || contents_[pos_] == '('))
+        fail("Invalid cell");
+    builder_.valReference(col, row, col_abs, row_abs);
+}
+
+//a number is a sequence of digits optionally followed by a decimal point with more digits and by an exponent
+//return false if the exponent has no digits
+bool CParser::scanNumber(std::string_view str, size_t& pos, double& number){
+    size_t begin = pos;
+    while(pos < str.size() && isDigit(str[pos]))
+        ++pos;
+    if(pos < str.size() && str[pos] == '.')
+        ++pos;
+    while(pos < str.size() && isDigit(str[pos]))
+        ++pos;
+    if(pos < str.size() && (str[pos] == 'e' || str[pos] == 'E')){
+        ++pos;
+        if(pos < str.size() && (str[pos] == '+' || str[pos] == '-'))
+            ++pos;
+        size_t digits = pos;
+        while(pos < str.size() && isDigit(str[pos]))
+            ++pos;
+        if(pos == digits)
+            return false;
+    }
+    std::string_view token = str.substr(begin, pos - begin);
+    //numbers out of the range of double become infinity or zero as with strtod
+    if(std::from_chars(token.data(), token.data() + token.size(), number).ec == std::errc::result_out_of_range)
+        number = std::strtod(std::string(token).c_str(), nullptr);
+    return true;
+}
+
+char CParser::next(){
+    while(pos_ < contents_.size() && std::isspace((unsigned char)contents_[pos_]))
+        ++pos_;
+    return pos_ < contents_.size() ? contents_[pos_] : '\0';
+}
+
+char CParser::lookahead() const{
+    return pos_ + 1 < contents_.size() ? contents_[pos_ + 1] : '\0';
+}
+
+void CParser::fail(const char* message) const{
+    throw std::invalid_argument(std::string(message) + " at position " + std::to_string(pos_));
+}
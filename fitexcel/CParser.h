@@ -0,0 +1,77 @@
+#ifndef CParser_h
+#define CParser_h
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+class CASTBuilder;
+
+
+//recursive descent parser of the contents of a cell, builds the AST of the contents directly in a CASTBuilder
+//contents starting with '=' are parsed as an expression, anything else as a number if the whole of it is a number
+//and as a string otherwise
+//the parser reads the contents in place, tokens are never copied, only a string literal containing escaped quotes
+//is unescaped into a buffer of the parser
+//all state is held by the parser object, so parsers on different threads only need builders of their own
+//grammar of an expression, the operators of one level are left associative:
+//  equality   := relation (('=' | '<>') relation)*
+//  relation   := sum (('<' | '<=' | '>' | '>=') sum)*
+//  sum        := product (('+' | '-') product)*
+//  product    := unary (('*' | '/') unary)*
+//  unary      := '-' unary | power
+//  power      := primary ('^' primary)*
+//  primary    := number | string | reference | '(' equality ')'
+class CParser {
+public:
+    CParser(std::string_view contents, CASTBuilder& builder) : contents_(contents), builder_(builder) {}
+
+    //parse the contents, throw std::invalid_argument if they are not valid
+    //on success the root of the AST is left in the builder
+    void parse();
+
+    //return true and store the number to number if contents not starting with '=' are a number literal
+    static bool literalNumber(std::string_view contents, double& number);
+
+private:
+    void parseEquality();
+    void parseRelation();
+    void parseSum();
+    void parseProduct();
+    void parseUnary();
+    void parsePower();
+    void parsePrimary();
+    void parseString();
+    void parseReference();
+
+    //read a number starting at pos of str into number and move pos past it, return false if it is malformed
+    static bool scanNumber(std::string_view str, size_t& pos, double& number);
+
+    //skip spaces and return the next character, '\0' at the end of the contents
+    char next();
+    //return the character after the next one without skipping spaces
+    char lookahead() const;
+
+    [[noreturn]] void fail(const char* message) const;
+
+    //limits the depth of the recursion, so a deeply nested expression is rejected instead of overflowing the stack
+    struct CNesting {
+        static constexpr size_t MAX_DEPTH = 1000;
+        explicit CNesting(CParser& parser) : parser_(parser){
+            if(++parser_.depth_ > MAX_DEPTH)
+                parser_.fail("Expression is nested too deeply");
+        }
+        ~CNesting(){
+            --parser_.depth_;
+        }
+        CParser& parser_;
+    };
+
+    std::string_view contents_;
+    size_t pos_ = 0;
+    CASTBuilder& builder_;
+    std::string buffer_;
+    size_t depth_ = 0;
+};
+
+#endif /* CParser_h */
@@ -23,8 +23,6 @@ CPos::CPos(std::string_view str) : col_(0), row_(0){
     row_ = std::atoi(&(str[idx]));
 }
 
-CPos::CPos(int col, int row) : col_(col), row_(row) {}
-
 
 bool operator <(const CPos& a, const CPos& b) {
     if(a.col() != b.col())
@@ -52,11 +50,17 @@ int getInt(const std::string& s){
 //transform integer value representing vertical coordinate in the spreadsheet into the corresponding string
 std::string getString(int n){
     std::string s;
+    writeColumn(s, n);
+    return s;
+}
+
+//append the string of the vertical coordinate without building a temporary string
+void writeColumn(std::string& out, int n){
+    char letters[8];
+    char* begin = letters + sizeof(letters);
     while(n > 0){
-        char c = 'A' + (n - 1) % 26;
-        s.push_back(c);
+        *--begin = (char)('A' + (n - 1) % 26);
         n = (n - 1) / 26;
     }
-    std::reverse(s.begin(), s.end());
-    return s;
+    out.append(begin, letters + sizeof(letters));
 }
@@ -32,6 +32,9 @@
 #include <charconv>
 #include <span>
 #include <utility>
+#ifndef CPos_h
+#define CPos_h
+
 #include "expression.h"
 
 
@@ -45,7 +48,7 @@ public:
     int row() const{
         return row_;
     }
-    CPos(int col, int row);
+    CPos(int col, int row) : col_(col), row_(row) {}
 private:
     int col_;
     int row_;
@@ -54,5 +57,15 @@ private:
 bool operator <(const CPos& a, const CPos& b);
 bool operator ==(const CPos& a, const CPos& b);
 
+template<>
+struct std::hash<CPos> {
+    size_t operator ()(const CPos& pos) const noexcept{
+        return std::hash<unsigned long long>{}(((unsigned long long)(unsigned)pos.col() << 32) | (unsigned)pos.row());
+    }
+};
+
 int getInt(const std::string& s);
 std::string getString(int n);
+void writeColumn(std::string& out, int n);
+
+#endif /* CPos_h */
@@ -0,0 +1,262 @@
+#include <algorithm>
+#include <memory>
+#include "CBinary.h"
+#include "CProgram.h"
+#include "CSimd.h"
+
+void CProgram::push(){
+    max_depth_ = std::max(max_depth_, ++depth_);
+}
+
+void CProgram::emitNumber(double number){
+    push();
+    CInstruction ins{COp::Number, false, false, 0, {}};
+    ins.number = number;
+    code_.push_back(ins);
+}
+
+void CProgram::emitString(const std::string& str){
+    push();
+    CInstruction ins{COp::String, false, false, 0, {}};
+    ins.string = (unsigned)strings_.size();
+    strings_.emplace_back(std::string_view(str));
+    code_.push_back(ins);
+}
+
+void CProgram::emitReference(int col, int row, bool col_abs, bool row_abs){
+    push();
+    CInstruction ins{COp::Reference, col_abs, row_abs, row, {}};
+    ins.col = col;
+    code_.push_back(ins);
+}
+
+void CProgram::emitOperation(COp op){
+    if(op != COp::Neg)
+        --depth_;
+    code_.push_back({op, false, false, 0, {}});
+}
+
+void CProgram::serialize(CBinaryWriter& writer) const{
+    writer.putUnsigned((uint32_t)code_.size());
+    for(const CInstruction& ins : code_){
+        writer.putByte((unsigned char)ins.op);
+        if(ins.op == COp::Number)
+            writer.putDouble(ins.number);
+        else if(ins.op == COp::String)
+            writer.putString(strings_[ins.string].flatten());
+        else if(ins.op == COp::Reference){
+            writer.putByte(ins.col_abs | ins.row_abs << 1);
+            writer.putInt(ins.col);
+            writer.putInt(ins.row);
+        }
+    }
+}
+
+void CProgram::serializeTemplate(CBinaryWriter& writer, long long col, long long row) const{
+    writer.putUnsigned((uint32_t)code_.size());
+    for(const CInstruction& ins : code_){
+        writer.putByte((unsigned char)ins.op);
+        if(ins.op == COp::Number)
+            writer.putDouble(ins.number);
+        else if(ins.op == COp::String)
+            writer.putString(strings_[ins.string].flatten());
+        else if(ins.op == COp::Reference){
+            writer.putByte(ins.col_abs | ins.row_abs << 1);
+            writer.putUnsigned64(ins.col_abs ? ins.col : ins.col - col);
+            writer.putUnsigned64(ins.row_abs ? ins.row : ins.row - row);
+        }
+    }
+}
+
+void CProgram::clear(){
+    code_.clear();
+    strings_.clear();
+    depth_ = 0;
+    max_depth_ = 0;
+}
+
+//operations on two numbers are done directly on the doubles, a string, a reference to a value that is not a number
+//and a division by zero push a value that is not a number, so the rest of the program is run by runBoxed
+CBoxedValue CProgram::run(CEvaluator& ev, int w, int h) const{
+    double local[LOCAL_DEPTH];
+    std::unique_ptr<double[]> allocated;
+    double* stack = local;
+    if(max_depth_ > LOCAL_DEPTH){
+        allocated = std::make_unique_for_overwrite<double[]>(max_depth_);
+        stack = allocated.get();
+    }
+    double* top = stack;
+    const CInstruction* begin = code_.data();
+    const CInstruction* end = begin + code_.size();
+    for(const CInstruction* ins = begin; ins != end; ++ins){
+        switch(ins->op){
+            case COp::Number:
+                *top++ = ins->number;
+                break;
+            case COp::String: [[unlikely]]
+                return runBoxed(ev, w, h, ins - begin + 1, stack, top - stack, strings_[ins->string]);
+            case COp::Reference: {
+                CBoxedValue value = ev.boxedValueAt(ins->reference(w, h));
+                if(!value.isNumber()) [[unlikely]]
+                    return runBoxed(ev, w, h, ins - begin + 1, stack, top - stack, std::move(value));
+                *top++ = value.number();
+                break;
+            }
+            case COp::Add: --top; top[-1] += top[0]; break;
+            case COp::Sub: --top; top[-1] -= top[0]; break;
+            case COp::Mul: --top; top[-1] *= top[0]; break;
+            case COp::Div:
+                --top;
+                if(top[0] == 0) [[unlikely]]
+                    return runBoxed(ev, w, h, ins - begin + 1, stack, top - stack - 1, CBoxedValue());
+                top[-1] /= top[0];
+                break;
+            case COp::Pow: --top; top[-1] = pow(top[-1], top[0]); break;
+            case COp::Neg: top[-1] = -top[-1]; break;
+            case COp::Eq: --top; top[-1] = (top[-1] == top[0]) * 1.0; break;
+            case COp::Ne: --top; top[-1] = (top[-1] != top[0]) * 1.0; break;
+            case COp::Lt: --top; top[-1] = (top[-1] < top[0]) * 1.0; break;
+            case COp::Le: --top; top[-1] = (top[-1] <= top[0]) * 1.0; break;
+            case COp::Gt: --top; top[-1] = (top[-1] > top[0]) * 1.0; break;
+            case COp::Ge: --top; top[-1] = (top[-1] >= top[0]) * 1.0; break;
+        }
+    }
+    return stack[0];
+}
+
+//continue the run from the instruction pc, the numbers are at the bottom of the stack and the value pushed by the
+//instruction before pc on its top
+CBoxedValue CProgram::runBoxed(CEvaluator& ev, int w, int h, size_t pc, const double* numbers, size_t top,
+                               CBoxedValue pushed) const{
+    auto run = [&](CBoxedValue* stack){
+        std::copy_n(numbers, top, stack);
+        stack[top] = std::move(pushed);
+        return runBoxed(ev, w, h, pc, stack, top + 1);
+    };
+    if(max_depth_ > LOCAL_DEPTH){
+        std::vector<CBoxedValue> stack(max_depth_);
+        return run(stack.data());
+    }
+    CBoxedValue stack[LOCAL_DEPTH];
+    return run(stack);
+}
+
+CBoxedValue CProgram::runBoxed(CEvaluator& ev, int w, int h, size_t pc, CBoxedValue* stack, size_t top) const{
+    for(; pc < code_.size(); ++pc){
+        const CInstruction& ins = code_[pc];
+        switch(ins.op){
+            case COp::Number:
+                stack[top++] = ins.number;
+                continue;
+            case COp::String:
+                stack[top++] = strings_[ins.string];
+                continue;
+            case COp::Reference:
+                stack[top++] = ev.boxedValueAt(ins.reference(w, h));
+                continue;
+            case COp::Neg:
+                stack[top - 1] = negValue(stack[top - 1]);
+                continue;
+            default:
+                break;
+        }
+        CBoxedValue& left = stack[top - 2];
+        const CBoxedValue& right = stack[top - 1];
+        --top;
+        if(left.isNumber() && right.isNumber()){
+            double l = left.number(), r = right.number();
+            switch(ins.op){
+                case COp::Add: left = l + r; break;
+                case COp::Sub: left = l - r; break;
+                case COp::Mul: left = l * r; break;
+                case COp::Div: left = r != 0 ? CBoxedValue(l / r) : CBoxedValue(); break;
+                case COp::Pow: left = pow(l, r); break;
+                case COp::Eq: left = (l == r) * 1.0; break;
+                case COp::Ne: left = (l != r) * 1.0; break;
+                case COp::Lt: left = (l < r) * 1.0; break;
+                case COp::Le: left = (l <= r) * 1.0; break;
+                case COp::Gt: left = (l > r) * 1.0; break;
+                case COp::Ge: left = (l >= r) * 1.0; break;
+                default: break;
+            }
+            continue;
+        }
+        switch(ins.op){
+            case COp::Add: left = addValues(left, right); break;
+            case COp::Sub: left = subValues(left, right); break;
+            case COp::Mul: left = mulValues(left, right); break;
+            case COp::Div: left = divValues(left, right); break;
+            case COp::Pow: left = powValues(left, right); break;
+            case COp::Eq: left = eqValues(left, right); break;
+            case COp::Ne: left = neValues(left, right); break;
+            case COp::Lt: left = ltValues(left, right); break;
+            case COp::Le: left = leValues(left, right); break;
+            case COp::Gt: left = gtValues(left, right); break;
+            case COp::Ge: left = geValues(left, right); break;
+            default: break;
+        }
+    }
+    return std::move(stack[0]);
+}
+
+void CProgram::collectReferences(std::vector<CPos>& refs, int w, int h) const{
+    for(const CInstruction& ins : code_)
+        if(ins.op == COp::Reference)
+            refs.push_back(ins.reference(w, h));
+}
+
+bool CProgram::vectorizable() const{
+    return !code_.empty() && strings_.empty();
+}
+
+//cells are processed in blocks of at most COLUMN_BLOCK lanes, every slot of the stack holds one value for each lane
+//of the block, so every instruction is executed once per block by the SIMD operations
+void CProgram::runColumn(const double* inputs, size_t count, double* out, unsigned char* fallback) const{
+    constexpr size_t COLUMN_BLOCK = 256;
+    std::vector<double> stack(max_depth_ * COLUMN_BLOCK);
+    for(size_t begin = 0; begin < count; begin += COLUMN_BLOCK){
+        size_t n = std::min(COLUMN_BLOCK, count - begin);
+        size_t top = 0, ref = 0;
+        for(const CInstruction& ins : code_){
+            if(ins.op == COp::Number){
+                std::fill_n(&stack[top++ * COLUMN_BLOCK], n, ins.number);
+                continue;
+            }
+            if(ins.op == COp::Reference){
+                std::copy_n(inputs + ref++ * count + begin, n, &stack[top++ * COLUMN_BLOCK]);
+                continue;
+            }
+            double* right = &stack[(top - 1) * COLUMN_BLOCK];
+            if(ins.op == COp::Neg){
+                for(size_t i = 0; i < n; ++i)
+                    right[i] = -right[i];
+                continue;
+            }
+            double* left = right - COLUMN_BLOCK;
+            switch(ins.op){
+                case COp::Add: simdApply<simdAdd>(left, right, left, n); break;
+                case COp::Sub: simdApply<simdSub>(left, right, left, n); break;
+                case COp::Mul: simdApply<simdMul>(left, right, left, n); break;
+                case COp::Div:
+                    for(size_t i = 0; i < n; ++i)
+                        if(right[i] == 0)
+                            fallback[begin + i] = 1;
+                    simdApply<simdDiv>(left, right, left, n);
+                    break;
+                case COp::Pow:
+                    for(size_t i = 0; i < n; ++i)
+                        left[i] = pow(left[i], right[i]);
+                    break;
+                case COp::Eq: simdApply<simdEq>(left, right, left, n); break;
+                case COp::Ne: simdApply<simdNe>(left, right, left, n); break;
+                case COp::Lt: simdApply<simdLt>(left, right, left, n); break;
+                case COp::Le: simdApply<simdLe>(left, right, left, n); break;
+                case COp::Gt: simdApply<simdGt>(left, right, left, n); break;
+                case COp::Ge: simdApply<simdGe>(left, right, left, n); break;
+                default: break;
+            }
+            --top;
+        }
+        std::copy_n(stack.begin(), n, out + begin);
+    }
+}
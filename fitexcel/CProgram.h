@@ -0,0 +1,88 @@
+#ifndef CProgram_h
+#define CProgram_h
+
+#include <string>
+#include <vector>
+#include "CEvaluator.h"
+
+class CBinaryWriter;
+
+//compiled form of an expression - a linear sequence of instructions for a stack machine in postfix order
+//operands are pushed on the stack and every operation replaces its operands on the top of the stack with its result,
+//so an expression is evaluated in a single loop without recursion or virtual calls per node
+//the depth of the stack is known once the program is built, so a run keeps its stack in a fixed array
+class CProgram {
+public:
+    enum class COp : unsigned char {
+        Number, String, Reference,
+        Add, Sub, Mul, Div, Pow, Neg,
+        Eq, Ne, Lt, Le, Gt, Ge
+    };
+
+    void emitNumber(double number);
+    void emitString(const std::string& str);
+    void emitReference(int col, int row, bool col_abs, bool row_abs);
+    void emitOperation(COp op);
+
+    void clear();
+
+    //run the program and return the value of the expression, values of referenced cells are read from the evaluator
+    //references that are not absolute are shifted by w columns and h rows
+    //the stack holds plain doubles as long as all values are numbers, the first value that is not a number continues
+    //the run on a stack of boxed values
+    CBoxedValue run(CEvaluator& ev, int w = 0, int h = 0) const;
+
+    //append the coordinates of all cells referenced by the program shifted by w columns and h rows to refs
+    void collectReferences(std::vector<CPos>& refs, int w = 0, int h = 0) const;
+
+    //true if the program contains no strings, such a program operates on numbers only and can be run by runColumn
+    bool vectorizable() const;
+
+    //run a vectorizable program for count cells at once, all referenced values have to be numbers
+    //the value of the k-th reference of the i-th cell is inputs[k * count + i], the result of the i-th cell is stored
+    //to out[i]; fallback[i] is set if the result is not a number (division by zero) and the cell has to be run alone
+    void runColumn(const double* inputs, size_t count, double* out, unsigned char* fallback) const;
+
+    //write the number of instructions and every instruction as its operation followed by its operand,
+    //a reference is written with its flags of absoluteness, the program can be rebuilt by replaying them in order
+    void serialize(CBinaryWriter& writer) const;
+
+    //write the program like serialize, but with the relative references as offsets from the given position, the
+    //programs of two cells written from the positions they were shifted from are the same if they refer to the same
+    //cells relative to the cells, so such cells may share one of the programs
+    void serializeTemplate(CBinaryWriter& writer, long long col, long long row) const;
+
+private:
+    //the deepest stack kept in an array on the stack of the caller, a deeper program allocates its stack
+    static constexpr size_t LOCAL_DEPTH = 32;
+
+    struct CInstruction {
+        COp op;
+        bool col_abs;
+        bool row_abs;
+        int row;
+        union {
+            double number;
+            int col;
+            unsigned string;
+        };
+
+        CPos reference(int w, int h) const{
+            return CPos(col_abs ? col : col + w, row_abs ? row : row + h);
+        }
+    };
+
+    CBoxedValue runBoxed(CEvaluator& ev, int w, int h, size_t pc, const double* numbers, size_t top,
+                         CBoxedValue pushed) const;
+    CBoxedValue runBoxed(CEvaluator& ev, int w, int h, size_t pc, CBoxedValue* stack, size_t top) const;
+    void push();
+
+    std::vector<CInstruction> code_;
+    //string literals are boxed once when the program is built, so pushing one only shares its buffer
+    std::vector<CBoxedValue> strings_;
+    //depth of the stack after the instructions emitted so far and the largest depth it reaches
+    size_t depth_ = 0;
+    size_t max_depth_ = 0;
+};
+
+#endif /* CProgram_h */
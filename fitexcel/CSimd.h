@@ -0,0 +1,80 @@
+#ifndef CSimd_h
+#define CSimd_h
+
+#include <cstddef>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+//element-wise operations on arrays of numbers used by the vectorized evaluation of formulas
+//AVX is used if the compiler targets it, SSE2 otherwise and a plain loop when neither of them is available
+//every operation gives exactly the same results as the corresponding scalar operation on doubles
+
+#if defined(__AVX__)
+using CSimdVector = __m256d;
+constexpr size_t SIMD_WIDTH = 4;
+inline CSimdVector simdLoad(const double* p){ return _mm256_loadu_pd(p); }
+inline void simdStore(double* p, CSimdVector v){ _mm256_storeu_pd(p, v); }
+inline CSimdVector simdAdd(CSimdVector a, CSimdVector b){ return _mm256_add_pd(a, b); }
+inline CSimdVector simdSub(CSimdVector a, CSimdVector b){ return _mm256_sub_pd(a, b); }
+inline CSimdVector simdMul(CSimdVector a, CSimdVector b){ return _mm256_mul_pd(a, b); }
+inline CSimdVector simdDiv(CSimdVector a, CSimdVector b){ return _mm256_div_pd(a, b); }
+//comparisons produce a mask, which is turned into 1.0 or 0.0
+inline CSimdVector simdBool(CSimdVector mask){ return _mm256_and_pd(mask, _mm256_set1_pd(1.0)); }
+inline CSimdVector simdEq(CSimdVector a, CSimdVector b){ return simdBool(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)); }
+inline CSimdVector simdNe(CSimdVector a, CSimdVector b){ return simdBool(_mm256_cmp_pd(a, b, _CMP_NEQ_UQ)); }
+inline CSimdVector simdLt(CSimdVector a, CSimdVector b){ return simdBool(_mm256_cmp_pd(a, b, _CMP_LT_OQ)); }
+inline CSimdVector simdLe(CSimdVector a, CSimdVector b){ return simdBool(_mm256_cmp_pd(a, b, _CMP_LE_OQ)); }
+inline CSimdVector simdGt(CSimdVector a, CSimdVector b){ return simdBool(_mm256_cmp_pd(a, b, _CMP_GT_OQ)); }
+inline CSimdVector simdGe(CSimdVector a, CSimdVector b){ return simdBool(_mm256_cmp_pd(a, b, _CMP_GE_OQ)); }
+#elif defined(__SSE2__)
+using CSimdVector = __m128d;
+constexpr size_t SIMD_WIDTH = 2;
+inline CSimdVector simdLoad(const double* p){ return _mm_loadu_pd(p); }
+inline void simdStore(double* p, CSimdVector v){ _mm_storeu_pd(p, v); }
+inline CSimdVector simdAdd(CSimdVector a, CSimdVector b){ return _mm_add_pd(a, b); }
+inline CSimdVector simdSub(CSimdVector a, CSimdVector b){ return _mm_sub_pd(a, b); }
+inline CSimdVector simdMul(CSimdVector a, CSimdVector b){ return _mm_mul_pd(a, b); }
+inline CSimdVector simdDiv(CSimdVector a, CSimdVector b){ return _mm_div_pd(a, b); }
+inline CSimdVector simdBool(CSimdVector mask){ return _mm_and_pd(mask, _mm_set1_pd(1.0)); }
+inline CSimdVector simdEq(CSimdVector a, CSimdVector b){ return simdBool(_mm_cmpeq_pd(a, b)); }
+inline CSimdVector simdNe(CSimdVector a, CSimdVector b){ return simdBool(_mm_cmpneq_pd(a, b)); }
+inline CSimdVector simdLt(CSimdVector a, CSimdVector b){ return simdBool(_mm_cmplt_pd(a, b)); }
+inline CSimdVector simdLe(CSimdVector a, CSimdVector b){ return simdBool(_mm_cmple_pd(a, b)); }
+inline CSimdVector simdGt(CSimdVector a, CSimdVector b){ return simdBool(_mm_cmpgt_pd(a, b)); }
+inline CSimdVector simdGe(CSimdVector a, CSimdVector b){ return simdBool(_mm_cmpge_pd(a, b)); }
+#else
+using CSimdVector = double;
+constexpr size_t SIMD_WIDTH = 1;
+inline CSimdVector simdLoad(const double* p){ return *p; }
+inline void simdStore(double* p, CSimdVector v){ *p = v; }
+inline CSimdVector simdAdd(CSimdVector a, CSimdVector b){ return a + b; }
+inline CSimdVector simdSub(CSimdVector a, CSimdVector b){ return a - b; }
+inline CSimdVector simdMul(CSimdVector a, CSimdVector b){ return a * b; }
+inline CSimdVector simdDiv(CSimdVector a, CSimdVector b){ return a / b; }
+inline CSimdVector simdEq(CSimdVector a, CSimdVector b){ return (a == b) * 1.0; }
+inline CSimdVector simdNe(CSimdVector a, CSimdVector b){ return (a != b) * 1.0; }
+inline CSimdVector simdLt(CSimdVector a, CSimdVector b){ return (a < b) * 1.0; }
+inline CSimdVector simdLe(CSimdVector a, CSimdVector b){ return (a <= b) * 1.0; }
+inline CSimdVector simdGt(CSimdVector a, CSimdVector b){ return (a > b) * 1.0; }
+inline CSimdVector simdGe(CSimdVector a, CSimdVector b){ return (a >= b) * 1.0; }
+#endif
+
+//apply op to a[i] and b[i] for every i < n and store the result to out[i], out may alias a or b
+//op is one of the functions above, elements that do not fill a whole vector are processed one by one
+template<CSimdVector (*op)(CSimdVector, CSimdVector)>
+inline void simdApply(const double* a, const double* b, double* out, size_t n){
+    size_t i = 0;
+    for(; i + SIMD_WIDTH <= n; i += SIMD_WIDTH)
+        simdStore(out + i, op(simdLoad(a + i), simdLoad(b + i)));
+    for(; i < n; ++i){
+        double lane[SIMD_WIDTH] = {}, left[SIMD_WIDTH] = {}, right[SIMD_WIDTH] = {};
+        left[0] = a[i];
+        right[0] = b[i];
+        simdStore(lane, op(simdLoad(left), simdLoad(right)));
+        out[i] = lane[0];
+    }
+}
+
+#endif /* CSimd_h */
@@ -1,14 +1,271 @@
 
+#include <future>
+#include <thread>
 #include "CSpreadsheet.h"
+#include "CBinaryFormat.h"
+#include "CBoundedQueue.h"
+#include "CCrc32c.h"
+#include "CLazyFile.h"
+#include "CLz.h"
+#include "CParser.h"
+#include "CTaskScheduler.h"
 
 CSpreadsheet::CSpreadsheet() = default;
 
 
-//load stored cells from istream until it is empty
+//first record of a file in the text format, files written before the text format had versions have no header
+static constexpr std::string_view TEXT_HEADER = "#FITEXCEL 2";
+//minimal size of a block of records covered by one checksum
+static constexpr size_t BLOCK_SIZE = 64 * 1024;
+//size of the chunks a text file is read in by the pipelined load
+static constexpr size_t READ_CHUNK = 1024 * 1024;
+
+static CCell makeCell(std::string_view contents, CASTBuilder& builder);
+
+bool CSpreadsheet::load(std::istream &is){
+    int first = is.peek();
+    if(first == BINARY_MAGIC[0])
+        return loadBinary(is);
+    if(first == TEXT_HEADER[0])
+        return loadText(is);
+    return loadLegacyText(is);
+}
+
+//read a record terminated by '|', a '|' inside of a string literal does not end the record
+//string literals are saved with doubled quotes, so a '|' is inside of one if an odd number of quotes precedes it
+static bool readRecord(std::istream& is, std::string& record){
+    if(!std::getline(is, record, '|'))
+        return false;
+    std::string rest;
+    while(std::count(record.begin(), record.end(), '\"') % 2 != 0 && !is.eof()){
+        if(!std::getline(is, rest, '|'))
+            return false;
+        record += '|';
+        record += rest;
+    }
+    return true;
+}
+
+//parse a checksum record made of its name and the checksum as 8 hexadecimal digits
+static bool parseChecksum(std::string_view record, std::string_view name, uint32_t& checksum){
+    if(record.size() != name.size() + 8 || record.substr(0, name.size()) != name)
+        return false;
+    const char* end = record.data() + record.size();
+    auto [ptr, ec] = std::from_chars(record.data() + name.size(), end, checksum, 16);
+    return ec == std::errc() && ptr == end;
+}
+
+static std::string checksumRecord(std::string_view name, uint32_t checksum){
+    char digits[9];
+    std::snprintf(digits, sizeof(digits), "%08x", checksum);
+    return std::string(name) + digits + "|";
+}
+
+//split a record 'col row contents' of the text format
+static bool parseTextRecord(std::string_view record, int& col, int& row, std::string_view& contents){
+    const char* end = record.data() + record.size();
+    auto parsed = std::from_chars(record.data(), end, col);
+    if(parsed.ec != std::errc() || parsed.ptr == end || *parsed.ptr != ' ')
+        return false;
+    parsed = std::from_chars(parsed.ptr + 1, end, row);
+    if(parsed.ec != std::errc() || parsed.ptr == end || *parsed.ptr != ' ')
+        return false;
+    contents = std::string_view(parsed.ptr + 1, end);
+    return true;
+}
+
+//load the header, then records 'col row =expr' of the cells, every block of them is followed by the record
+//'#block crc' with the CRC-32C of the block, the last one by '#end crc'
+//the checksum is computed while the cells are parsed, so a damaged block is found without storing the file
+//return false and leave the spreadsheet unchanged if any record is invalid or any checksum does not match
+bool CSpreadsheet::loadText(std::istream &is){
+    std::string record;
+    if(!readRecord(is, record) || record != TEXT_HEADER)
+        return false;
+    if(threads_ > 1)
+        return loadTextPipelined(is);
+    CSpreadsheet x;
+    CCrc32c crc;
+    bool ended = false;
+    while(!ended && readRecord(is, record)){
+        if(!record.empty() && record[0] == '#'){
+            uint32_t saved;
+            ended = parseChecksum(record, "#end ", saved);
+            if(!ended && !parseChecksum(record, "#block ", saved))
+                return false;
+            if(saved != crc.value())
+                return false;
+            crc.reset();
+            continue;
+        }
+        crc.update(record);
+        crc.update("|");
+        int col, row;
+        std::string_view contents;
+        if(!parseTextRecord(record, col, row, contents) || !x.setCell(CPos(col, row), std::string(contents)))
+            return false;
+    }
+    if(!ended || is.bad() || is.get() != EOF)
+        return false;
+    return takeLoaded(std::move(x));
+}
+
+//cells parsed from a block of the text format, nullopt if the block is not valid
+using CParsedBlock = std::optional<std::vector<std::pair<CPos, CCell>>>;
+
+//block of records of the text format and the checksum saved after it, the records end at the offsets in ends,
+//where their '|' is, the promise is fulfilled by the parser of the block
+struct CTextBlock {
+    std::string text;
+    std::vector<size_t> ends;
+    uint32_t checksum = 0;
+    std::promise<CParsedBlock> parsed;
+};
+
+//reader of the blocks of a text file for the pipelined load, the stream is read in large chunks and the records are
+//found by a single scan for '|' and quotes, a '|' inside of a string literal does not end a record, see readRecord
+class CTextBlockReader {
+public:
+    explicit CTextBlockReader(std::istream& is) : is_(is) {}
+
+    //read the records of the next block and the checksum record following them
+    //return false if the data ends before the checksum record
+    bool next(CTextBlock& block, std::string& checksum){
+        size_t begin = begin_, record = begin_, scan = begin_;
+        bool quoted = false;
+        while(true){
+            size_t found = buffer_.find_first_of(quoted ? "\"" : "|\"", scan);
+            if(found == std::string::npos){
+                //the data before the block was taken already, so it is dropped before the next chunk is read
+                size_t shift = begin_;
+                buffer_.erase(0, shift);
+                begin_ = 0;
+                begin -= shift;
+                record -= shift;
+                scan = buffer_.size();
+                if(!fill())
+                    return false;
+                continue;
+            }
+            if(buffer_[found] == '"'){
+                quoted = !quoted;
+                scan = found + 1;
+                continue;
+            }
+            if(buffer_[record] == '#'){
+                block.text.assign(buffer_, begin, record - begin);
+                checksum.assign(buffer_, record, found - record);
+                begin_ = found + 1;
+                return true;
+            }
+            block.ends.push_back(found - begin);
+            record = scan = found + 1;
+        }
+    }
+
+    //return true if all data was read
+    bool atEnd(){
+        return begin_ == buffer_.size() && !is_.bad() && is_.peek() == EOF;
+    }
+
+private:
+    bool fill(){
+        size_t size = buffer_.size();
+        buffer_.resize(size + READ_CHUNK);
+        is_.read(buffer_.data() + size, READ_CHUNK);
+        buffer_.resize(size + (size_t)is_.gcount());
+        return buffer_.size() > size;
+    }
+
+    std::istream& is_;
+    std::string buffer_;
+    //start of the data that was not taken yet
+    size_t begin_ = 0;
+};
+
+//verify the checksum of a block and parse all its records
+static CParsedBlock parseTextBlock(const CTextBlock& block, CASTBuilder& builder){
+    if(CCrc32c::of(block.text) != block.checksum)
+        return std::nullopt;
+    std::vector<std::pair<CPos, CCell>> cells;
+    cells.reserve(block.ends.size());
+    size_t start = 0;
+    for(size_t end : block.ends){
+        int col, row;
+        std::string_view contents;
+        if(!parseTextRecord(std::string_view(block.text).substr(start, end - start), col, row, contents))
+            return std::nullopt;
+        try{
+            cells.emplace_back(CPos(col, row), makeCell(contents, builder));
+        }
+        catch(std::exception& e){
+            std::cerr << e.what() << std::endl;
+            return std::nullopt;
+        }
+        start = end + 1;
+    }
+    return cells;
+}
+
+//load the records following the header of a text file in a pipeline of three stages
+//a reader thread splits the stream into its blocks, threads_ parser threads verify the checksums of the blocks and
+//parse their records concurrently, every one with a builder of its own, and the calling thread stores the parsed
+//cells in the order of the file, so a later record overwrites an earlier one as in the sequential load
+//the queues between the stages are bounded, so only a few blocks are held in memory at once
+//an invalid block closes the queues, which stops the reader, and the spreadsheet is left unchanged
+bool CSpreadsheet::loadTextPipelined(std::istream& is){
+    CSpreadsheet x;
+    CBoundedQueue<std::shared_ptr<CTextBlock>> blocks(4 * threads_);
+    CBoundedQueue<std::future<CParsedBlock>> parsed(4 * threads_);
+    bool read = false;
+    std::vector<std::jthread> parsers;
+    for(unsigned i = 0; i < threads_; ++i)
+        parsers.emplace_back([&blocks]{
+            CASTBuilder builder;
+            std::shared_ptr<CTextBlock> block;
+            while(blocks.pop(block))
+                block->parsed.set_value(parseTextBlock(*block, builder));
+        });
+    std::jthread reading([&]{
+        CTextBlockReader reader(is);
+        bool ended = false;
+        while(!ended){
+            auto block = std::make_shared<CTextBlock>();
+            std::string checksum;
+            if(!reader.next(*block, checksum))
+                break;
+            ended = parseChecksum(checksum, "#end ", block->checksum);
+            if(!ended && !parseChecksum(checksum, "#block ", block->checksum))
+                break;
+            if(!parsed.push(block->parsed.get_future()) || !blocks.push(block))
+                break;
+        }
+        read = ended && reader.atEnd();
+        parsed.close();
+        blocks.close();
+    });
+    bool valid = true;
+    std::future<CParsedBlock> block;
+    while(valid && parsed.pop(block)){
+        CParsedBlock cells = block.get();
+        valid = cells.has_value();
+        if(valid)
+            for(auto& [pos, cell] : *cells)
+                x.updateCycles(pos, x.storeCell(pos, std::move(cell)));
+    }
+    parsed.close();
+    blocks.close();
+    reading.join();
+    if(!valid || !read)
+        return false;
+    return takeLoaded(std::move(x));
+}
+
+//load a text file written before the format had versions
 //assume only correctly parsed expressions were saved, return false if any error is encountered
 //check whether the hash of a string of concatenated loaded expressions with their coordinates equals the saved hash
 //if not return false - some cells were not loaded properly
-bool CSpreadsheet::load(std::istream &is){
+bool CSpreadsheet::loadLegacyText(std::istream &is){
     CSpreadsheet x;
     int col, row;
     std::string to_hash;
@@ -34,11 +291,176 @@ bool CSpreadsheet::load(std::istream &is){
     if(!(iss >> saved_hash) || saved_hash != std::hash<std::string>{}(to_hash) || is.bad() || is.get() != EOF
             || col != 0 || row != 0)
         return false;
-    for(auto& cell : cells_)
-        delete cell.second;
-    cells_.clear();
-    for(auto& cell : x.cells_)
-        cells_[cell.first] = (cell.second ? cell.second->clone() : nullptr);
+    return takeLoaded(std::move(x));
+}
+
+//source of the records of a binary file, version 1 stores them unchecked up to the end of the file, later versions
+//in blocks, each of them preceded by its size and followed by its CRC-32C, and end with an empty block
+//the blocks of the compressed format are preceded by their compressed size and their size and are checked after
+//they are decompressed
+//a record never spans two blocks and every block is verified as soon as it is read, so a damaged block is found
+//before any of its records is decoded and only one block is kept in memory
+class CBlockReader {
+public:
+    enum class CLayout {
+        Unframed,
+        Framed,
+        //framed, followed by the index and the footer since version 3
+        Indexed,
+        Compressed
+    };
+
+    CBlockReader(std::istream& is, CLayout layout) : is_(is), layout_(layout) {}
+
+    //return the reader of the block containing the next record, throw std::invalid_argument if there is none
+    CBinaryReader& next(){
+        while(reader_.atEnd())
+            if(!readBlock())
+                throw std::invalid_argument("Missing data");
+        return reader_;
+    }
+
+    //return true if the data ends right after the last record, or after the index and the footer since version 3
+    //the index is only used by lazy loading, it is verified as any other block
+    bool finish(){
+        if(!reader_.atEnd() || (!ended_ && readBlock()))
+            return false;
+        if(layout_ == CLayout::Indexed){
+            ended_ = false;
+            if(!readBlock())
+                return false;
+            char footer[BINARY_FOOTER_SIZE];
+            if(!is_.read(footer, sizeof(footer)) || std::string_view(footer + 8, 4) != INDEX_MAGIC)
+                return false;
+        }
+        return !is_.bad() && is_.get() == EOF;
+    }
+
+private:
+    //read the next block, return false if the end of the data was reached
+    bool readBlock(){
+        if(ended_)
+            return false;
+        if(layout_ == CLayout::Unframed){
+            block_.assign(std::istreambuf_iterator<char>(is_), std::istreambuf_iterator<char>());
+            ended_ = true;
+            reader_ = CBinaryReader(block_);
+            return !block_.empty();
+        }
+        uint32_t size = readUnsigned();
+        if(size == 0){
+            ended_ = true;
+            return false;
+        }
+        if(size > MAX_BINARY_BLOCK_SIZE)
+            throw std::invalid_argument("Invalid block size");
+        if(layout_ == CLayout::Compressed){
+            //a byte of compressed data produces at most 255 bytes, a damaged size is found before allocating for it
+            uint32_t raw_size = readUnsigned();
+            if(raw_size > MAX_BINARY_BLOCK_SIZE || raw_size > 255ull * size + 16)
+                throw std::invalid_argument("Invalid block size");
+            compressed_.resize(size);
+            if(!is_.read(compressed_.data(), size) || !lzDecompress(compressed_, raw_size, block_)
+               || readUnsigned() != CCrc32c::of(block_))
+                throw std::invalid_argument("Damaged block");
+        }
+        else{
+            block_.resize(size);
+            if(!is_.read(block_.data(), size) || readUnsigned() != CCrc32c::of(block_))
+                throw std::invalid_argument("Damaged block");
+        }
+        reader_ = CBinaryReader(block_);
+        return true;
+    }
+
+    uint32_t readUnsigned(){
+        char bytes[4];
+        if(!is_.read(bytes, sizeof(bytes)))
+            throw std::invalid_argument("Missing data");
+        return CBinaryReader(std::string_view(bytes, sizeof(bytes))).getUnsigned();
+    }
+
+    std::istream& is_;
+    CLayout layout_;
+    std::string block_;
+    std::string compressed_;
+    CBinaryReader reader_{std::string_view()};
+    bool ended_ = false;
+};
+
+//decode the formula table and then the cells referring to the formulas by their indices, no text is parsed
+//cells sharing a formula when saved share it again after loading
+//a compressed file has the same records, only its cells are coded differently and its blocks are decompressed one
+//by one as they are read
+//return false and leave the spreadsheet unchanged if the data is not a complete file of a known version
+bool CSpreadsheet::loadBinary(std::istream &is){
+    using CLayout = CBlockReader::CLayout;
+    CSpreadsheet x;
+    try{
+        char header[BINARY_HEADER_SIZE];
+        if(!is.read(header, sizeof(header)))
+            return false;
+        CBinaryReader header_reader(std::string_view(header, sizeof(header)));
+        bool compressed = std::string_view(header, COMPRESSED_MAGIC.size()) == COMPRESSED_MAGIC;
+        header_reader.expect(compressed ? COMPRESSED_MAGIC : BINARY_MAGIC);
+        uint32_t version = header_reader.getUnsigned();
+        if(version < 1 || version > (compressed ? COMPRESSED_VERSION : BINARY_VERSION))
+            return false;
+        CLayout layout = compressed ? CLayout::Compressed
+                       : version == 1 ? CLayout::Unframed : version == 2 ? CLayout::Framed : CLayout::Indexed;
+        CBlockReader blocks(is, layout);
+        uint32_t formula_count = blocks.next().getUnsigned();
+        std::vector<std::shared_ptr<const CFormula>> formulas;
+        std::vector<CReferenceRange> ranges;
+        for(uint32_t i = 0; i < formula_count; ++i){
+            const CNode* ast = decodeFormula(blocks.next(), x.builder_, ranges.emplace_back());
+            formulas.push_back(std::make_shared<const CFormula>(ast, x.builder_.arena()));
+        }
+        uint64_t cell_count = blocks.next().getUnsigned64();
+        CCellDeltaCoder coder(formula_count);
+        for(uint64_t i = 0; i < cell_count; ++i){
+            CCell cell;
+            uint32_t index;
+            CPos pos = compressed ? coder.decode(blocks.next(), cell, index) : decodeCell(blocks.next(), cell, index);
+            if(index != NO_FORMULA){
+                if(index >= formulas.size() || !ranges[index].fits(cell.col_shift, cell.row_shift))
+                    return false;
+                cell.formula = formulas[index];
+            }
+            x.updateCycles(pos, x.storeCell(pos, std::move(cell)));
+        }
+        if(!blocks.finish())
+            return false;
+    }
+    catch(std::invalid_argument&){
+        return false;
+    }
+    return takeLoaded(std::move(x));
+}
+
+//move the cells and the dependency structures of a spreadsheet that was loaded completely into place
+//every load builds into a separate spreadsheet, so a failed load leaves this one unchanged, while a successful one
+//only moves the loaded structures and releases the old ones, nothing is copied
+//the formula cache, the number of threads and the journal are kept, the loaded contents become its new checkpoint
+//return false and leave the spreadsheet unchanged if the checkpoint cannot be written, the load then fails as well
+bool CSpreadsheet::takeLoaded(CSpreadsheet&& loaded){
+    if(journal_){
+        try{
+            loaded.writeCheckpoint(*journal_);
+        }
+        catch(std::runtime_error& e){
+            std::cerr << e.what() << std::endl;
+            return false;
+        }
+    }
+    cells_ = std::move(loaded.cells_);
+    cache_.clear();
+    dependents_ = std::move(loaded.dependents_);
+    cycle_id_ = std::move(loaded.cycle_id_);
+    cycles_ = std::move(loaded.cycles_);
+    next_cycle_id_ = loaded.next_cycle_id_;
+    lazy_ = std::move(loaded.lazy_);
+    pending_tiles_ = std::move(loaded.pending_tiles_);
     return true;
 }
 
@@ -54,161 +476,1225 @@ bool CSpreadsheet::load(std::ifstream &ifs){
     return true;
 }
 bool CSpreadsheet::load(const std::string& filename){
-    std::ifstream ifs(filename);
+    std::ifstream ifs(filename, std::ios::binary);
     return load(ifs);
 }
 
-//save cell coordinates and expression delimited by '|' for every cell in the output stream,
-//if cell is empty save '0' as expression
-//also save the hash of a string of concatenated saved expressions with their coordinates for file control in load
-bool CSpreadsheet::save(std::ostream &os) const{
-    std::string to_hash;
-    std::string s;
-    for(const auto& cell : cells_){
-        if(cell.second == nullptr)
+//a lazy load only reads the index of the tiles, their cells are decoded by materializeTile
+bool CSpreadsheet::load(const std::string& filename, CLoadMode mode){
+    std::shared_ptr<CLazyFile> file = mode == CLoadMode::Lazy ? CLazyFile::open(filename) : nullptr;
+    if(!file)
+        return load(filename);
+    CSpreadsheet x;
+    std::vector<uint64_t> tiles = file->tiles();
+    x.pending_tiles_.insert(tiles.begin(), tiles.end());
+    if(!tiles.empty())
+        x.lazy_ = std::move(file);
+    return takeLoaded(std::move(x));
+}
+
+void CSpreadsheet::materialize(){
+    materializeAll();
+}
+
+//decode the tile containing the cell if it was not decoded yet
+void CSpreadsheet::materializeAt(const CPos& pos){
+    if(lazy_){
+        uint64_t key = CGrid<CCell>::tileKey(pos);
+        if(pending_tiles_.count(key))
+            materializeTile(key);
+    }
+}
+
+//store the cells of a tile of the lazily loaded file, the cells of the tile were not stored or referenced by
+//any cached value yet, so no value has to be invalidated, a cycle is found when its last cell is stored
+void CSpreadsheet::materializeTile(uint64_t key){
+    std::vector<std::pair<CPos, CCell>> cells = lazy_->decodeTile(key);
+    pending_tiles_.erase(key);
+    for(auto& [pos, cell] : cells)
+        updateCycles(pos, storeCell(pos, std::move(cell)));
+    if(pending_tiles_.empty())
+        lazy_.reset();
+}
+
+//decode the tiles of all cells the cell depends on, a cell with a cached value was evaluated with all cells it
+//depends on decoded, so the search does not continue from it
+//decoding does not change the contents of the spreadsheet, only the cells it has stored, so it is done by
+//const queries as well
+void CSpreadsheet::materializeReachable(const CPos& pos) const{
+    if(!lazy_)
+        return;
+    CSpreadsheet& self = const_cast<CSpreadsheet&>(*this);
+    std::vector<CPos> stack = {pos};
+    std::unordered_set<CPos> visited = {pos};
+    std::vector<CPos> refs;
+    while(!stack.empty() && lazy_){
+        CPos cur = stack.back();
+        stack.pop_back();
+        if(cache_.count(cur))
             continue;
-        os << cell.first.col() << " " << cell.first.row() << " ";
-        s = cell.second->reconstruct();
-        os << "=" << s << "|";
-        to_hash += "=" + s + std::to_string(cell.first.col()) + std::to_string(cell.first.row());
+        self.materializeAt(cur);
+        refs.clear();
+        references(cur, refs);
+        for(const CPos& ref : refs)
+            if(visited.insert(ref).second)
+                stack.push_back(ref);
     }
-    os << 0 << " " << 0 << " " << std::hash<std::string>{}(to_hash) << "|";
+}
+
+void CSpreadsheet::materializeAll() const{
+    if(!lazy_)
+        return;
+    CSpreadsheet& self = const_cast<CSpreadsheet&>(*this);
+    std::vector<uint64_t> tiles(pending_tiles_.begin(), pending_tiles_.end());
+    for(uint64_t key : tiles)
+        self.materializeTile(key);
+}
+
+//kind of a record of the journal, setCell and setCells record the positions and the contents of the cells they set,
+//copyRect records its arguments
+enum class CJournalRecord : unsigned char {
+    SetCells,
+    CopyRect
+};
+
+static void putCell(CBinaryWriter& writer, const CPos& pos, std::string_view contents){
+    writer.putInt(pos.col());
+    writer.putInt(pos.row());
+    writer.putString(contents);
+}
+
+//the checkpoint is loaded and its journal replayed into a separate spreadsheet, so this one is left unchanged and
+//keeps recording into the journal it kept before if either of them is not valid
+bool CSpreadsheet::openJournal(const std::string& filename, uint64_t min_journal_size){
+    auto journal = std::make_unique<CJournal>(filename, min_journal_size);
+    try{
+        std::string checkpoint;
+        std::vector<std::string> records;
+        if(!journal->read(checkpoint, records)){
+            writeCheckpoint(*journal);
+            journal_ = std::move(journal);
+            return true;
+        }
+        CSpreadsheet x;
+        std::istringstream iss(std::move(checkpoint));
+        if(!x.load(iss))
+            return false;
+        for(const std::string& record : records)
+            if(!x.replay(record))
+                return false;
+        //the loaded contents are the checkpoint of the new journal already, so none is written
+        journal_.reset();
+        takeLoaded(std::move(x));
+    }
+    catch(std::runtime_error& e){
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    journal_ = std::move(journal);
+    return true;
+}
+
+void CSpreadsheet::checkpoint(){
+    if(journal_)
+        writeCheckpoint(*journal_);
+}
+
+//write the contents of the spreadsheet as the checkpoint of the journal, which may belong to another spreadsheet
+void CSpreadsheet::writeCheckpoint(CJournal& journal) const{
+    std::ostringstream oss;
+    save(oss, CFileFormat::Binary);
+    journal.checkpoint(oss.str());
+}
+
+void CSpreadsheet::closeJournal(){
+    journal_.reset();
+}
+
+//called after a change was made, the change is recorded already, so a failed compaction is only reported and it is
+//tried again after the next change
+void CSpreadsheet::compactJournal(){
+    if(!journal_ || !journal_->full())
+        return;
+    try{
+        checkpoint();
+    }
+    catch(std::runtime_error& e){
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+//make the change of a record of the journal, return false if the record is not valid
+bool CSpreadsheet::replay(std::string_view record){
+    try{
+        CBinaryReader reader(record);
+        CJournalRecord kind = (CJournalRecord)reader.getByte();
+        if(kind == CJournalRecord::SetCells){
+            uint32_t count = reader.getUnsigned();
+            std::vector<std::pair<CPos, std::string>> contents;
+            for(uint32_t i = 0; i < count; ++i){
+                int col = reader.getInt();
+                int row = reader.getInt();
+                contents.emplace_back(CPos(col, row), reader.getString());
+            }
+            setCells(contents);
+        }
+        else if(kind == CJournalRecord::CopyRect){
+            int dst_col = reader.getInt(), dst_row = reader.getInt();
+            int src_col = reader.getInt(), src_row = reader.getInt();
+            int w = reader.getInt(), h = reader.getInt();
+            copyRect(CPos(dst_col, dst_row), CPos(src_col, src_row), w, h);
+        }
+        else
+            return false;
+        return reader.atEnd();
+    }
+    //a record whose operation fails is not valid either, so it cannot make the journal impossible to open
+    catch(std::exception&){
+        return false;
+    }
+}
+
+bool CSpreadsheet::save(std::ostream &os, CFileFormat format) const{
+    materializeAll();
+    switch(format){
+        case CFileFormat::Binary: return saveBinary(os);
+        case CFileFormat::Compressed: return saveCompressed(os);
+        default: return saveText(os);
+    }
+}
+
+//append the decimal digits of the number
+static void writeInt(std::string& out, int number){
+    char buffer[16];
+    out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), number).ptr);
+}
+
+//save the header and the record 'col row =expr' of every cell, the expression is reconstructed from the cell
+//every block of records is followed by the record with its checksum, see loadText
+//the records are appended to a single buffer, which is checksummed and written out after every block, so saving
+//a cell allocates nothing
+bool CSpreadsheet::saveText(std::ostream &os) const{
+    std::string out;
+    out.reserve(2 * BLOCK_SIZE);
+    out.append(TEXT_HEADER);
+    out.push_back('|');
+    size_t block = out.size();
+    for(const auto& cell : cells_){
+        writeInt(out, cell.first.col());
+        out.push_back(' ');
+        writeInt(out, cell.first.row());
+        out.append(" =");
+        cell.second.write(out);
+        out.push_back('|');
+        if(out.size() - block >= BLOCK_SIZE){
+            out.append(checksumRecord("#block ", CCrc32c::of(std::string_view(out).substr(block))));
+            os.write(out.data(), (std::streamsize)out.size());
+            out.clear();
+            block = 0;
+        }
+    }
+    out.append(checksumRecord("#end ", CCrc32c::of(std::string_view(out).substr(block))));
+    os.write(out.data(), (std::streamsize)out.size());
     if(os.bad())
         return false;
     return true;
 }
-bool CSpreadsheet::save(std::ofstream &ofs) const{
+
+//writer of the records of a binary file in blocks, it keeps the offset in the file of the next block
+//the blocks of the compressed format are compressed one by one, see CBlockReader
+class CBlockWriter {
+public:
+    explicit CBlockWriter(std::ostream& os, bool compress = false) : os_(os), writer_(block_), compress_(compress) {}
+
+    //writer of the records of the current block
+    CBinaryWriter& records(){
+        return writer_;
+    }
+
+    //end a record, write the block if it is large enough, return true if it was written
+    bool endRecord(){
+        if(block_.size() < BLOCK_SIZE)
+            return false;
+        flush();
+        return true;
+    }
+
+    //write the current block unless it is empty
+    void flush(){
+        if(block_.empty())
+            return;
+        writeFrame(block_);
+        block_.clear();
+    }
+
+    //write the last block and the empty block ending the records
+    void end(){
+        flush();
+        writeBytes(std::string(4, '\0'));
+    }
+
+    //end the records, then write the index in a block of its own and the footer
+    void finish(const CBinaryIndex& index){
+        end();
+        uint64_t index_offset = offset_;
+        index.serialize(writer_);
+        flush();
+        std::string footer;
+        CBinaryWriter writer(footer);
+        writer.putUnsigned64(index_offset);
+        writer.putBytes(INDEX_MAGIC);
+        writeBytes(footer);
+    }
+
+    void writeBytes(std::string_view bytes){
+        os_.write(bytes.data(), (std::streamsize)bytes.size());
+        offset_ += bytes.size();
+    }
+
+    uint64_t offset() const{
+        return offset_;
+    }
+
+private:
+    void writeFrame(std::string_view payload){
+        std::string frame;
+        CBinaryWriter writer(frame);
+        if(compress_){
+            compressed_.clear();
+            lzCompress(payload, compressed_);
+            writer.putUnsigned((uint32_t)compressed_.size());
+            writer.putUnsigned((uint32_t)payload.size());
+            writeBytes(frame);
+            writeBytes(compressed_);
+        }
+        else{
+            writer.putUnsigned((uint32_t)payload.size());
+            writeBytes(frame);
+            writeBytes(payload);
+        }
+        frame.clear();
+        writer.putUnsigned(CCrc32c::of(payload));
+        writeBytes(frame);
+    }
+
+    std::ostream& os_;
+    std::string block_;
+    CBinaryWriter writer_;
+    bool compress_;
+    std::string compressed_;
+    uint64_t offset_ = 0;
+};
+
+//save the magic bytes and the version, the table of distinct formulas as their compiled programs
+//and then the coordinates of every cell with its value or the index of its formula and its offset
+//the records are written in blocks with checksums, every tile starts a new block and the index of the blocks
+//of the formula table and of the tiles is written at the end, see CBinaryFormat.h
+bool CSpreadsheet::saveBinary(std::ostream &os) const{
+    CBlockWriter blocks(os);
+    std::string header;
+    CBinaryWriter writer(header);
+    writer.putBytes(BINARY_MAGIC);
+    writer.putUnsigned(BINARY_VERSION);
+    blocks.writeBytes(header);
+    std::unordered_map<const CFormula*, uint32_t> indices;
+    std::vector<const CFormula*> formulas;
+    for(const auto& cell : cells_)
+        if(cell.second.formula && indices.emplace(cell.second.formula.get(), (uint32_t)formulas.size()).second)
+            formulas.push_back(cell.second.formula.get());
+    CBinaryIndex index;
+    CBinaryWriter& records = blocks.records();
+    records.putUnsigned((uint32_t)formulas.size());
+    //the spans of the formula table end where a block ends, the last one ends with the number of cells
+    CBlockSpan span{blocks.offset(), 0, 0, 0};
+    auto endFormulaSpan = [&]{
+        span.size = blocks.offset() - span.offset;
+        if(span.count > 0)
+            index.formula_blocks.push_back(span);
+        span = CBlockSpan{blocks.offset(), 0, span.first + span.count, 0};
+    };
+    for(const CFormula* formula : formulas){
+        formula->program().serialize(records);
+        ++span.count;
+        if(blocks.endRecord())
+            endFormulaSpan();
+    }
+    records.putUnsigned64(cells_.size());
+    blocks.flush();
+    endFormulaSpan();
+    //the cells of a tile are visited one after another, every tile starts a new block
+    uint64_t tile = 0;
+    auto endTile = [&]{
+        blocks.flush();
+        span.size = blocks.offset() - span.offset;
+        index.tiles.emplace_back(tile, span);
+    };
+    for(const auto& cell : cells_){
+        uint64_t key = CGrid<CCell>::tileKey(cell.first);
+        if(span.count == 0 || key != tile){
+            if(span.count > 0)
+                endTile();
+            tile = key;
+            span = CBlockSpan{blocks.offset(), 0, 0, 0};
+        }
+        records.putInt(cell.first.col());
+        records.putInt(cell.first.row());
+        const CCell& c = cell.second;
+        if(c.formula){
+            records.putByte((unsigned char)CCellKind::Formula);
+            records.putUnsigned(indices[c.formula.get()]);
+            records.putInt(c.col_shift);
+            records.putInt(c.row_shift);
+        }
+        else if(c.value.isNumber()){
+            records.putByte((unsigned char)CCellKind::Number);
+            records.putDouble(c.value.number());
+        }
+        else{
+            records.putByte((unsigned char)CCellKind::String);
+            records.putString(c.value.flatten());
+        }
+        ++span.count;
+        blocks.endRecord();
+    }
+    if(span.count > 0)
+        endTile();
+    blocks.finish(index);
+    return !os.bad();
+}
+
+//save the records of the binary format with the cells coded by CCellDeltaCoder in compressed blocks
+//the formula table is a dictionary of templates, formulas that refer to the same cells relative to their cells are
+//stored once, even if they were set to every cell of a column separately, and every cell refers to its template by
+//its index and the origin it is shifted from, what still repeats in the records is left to the compression
+bool CSpreadsheet::saveCompressed(std::ostream &os) const{
+    //template of a formula cell, its index in the table and its origin
+    struct CTemplateCell {
+        uint32_t index;
+        long long col, row;
+    };
+    std::vector<const CFormula*> formulas;
+    std::vector<std::pair<long long, long long>> origins;
+    std::vector<CTemplateCell> template_cells;
+    std::unordered_map<std::string, uint32_t> templates;
+    std::string key;
+    CBinaryWriter key_writer(key);
+    for(const auto& cell : cells_){
+        const CCell& c = cell.second;
+        if(!c.formula)
+            continue;
+        long long col = (long long)cell.first.col() - c.col_shift, row = (long long)cell.first.row() - c.row_shift;
+        key.clear();
+        c.formula->program().serializeTemplate(key_writer, col, row);
+        auto it = templates.find(key);
+        if(it != templates.end()){
+            //the cell is shifted from the origin of the template, unless its offset from there does not fit an int
+            auto [template_col, template_row] = origins[it->second];
+            if(std::abs(cell.first.col() - template_col) <= INT_MAX
+               && std::abs(cell.first.row() - template_row) <= INT_MAX){
+                template_cells.push_back({it->second, template_col, template_row});
+                continue;
+            }
+        }
+        else
+            templates.emplace(key, (uint32_t)formulas.size());
+        template_cells.push_back({(uint32_t)formulas.size(), col, row});
+        formulas.push_back(c.formula.get());
+        origins.emplace_back(col, row);
+    }
+    CBlockWriter blocks(os, true);
+    std::string header;
+    CBinaryWriter writer(header);
+    writer.putBytes(COMPRESSED_MAGIC);
+    writer.putUnsigned(COMPRESSED_VERSION);
+    blocks.writeBytes(header);
+    CBinaryWriter& records = blocks.records();
+    records.putUnsigned((uint32_t)formulas.size());
+    for(const CFormula* formula : formulas){
+        formula->program().serialize(records);
+        blocks.endRecord();
+    }
+    records.putUnsigned64(cells_.size());
+    CCellDeltaCoder coder((uint32_t)formulas.size());
+    auto template_cell = template_cells.begin();
+    for(const auto& cell : cells_){
+        if(cell.second.formula){
+            coder.encodeFormula(records, cell.first, template_cell->index, template_cell->col, template_cell->row);
+            ++template_cell;
+        }
+        else
+            coder.encodeValue(records, cell.first, cell.second.value);
+        blocks.endRecord();
+    }
+    blocks.end();
+    return !os.bad();
+}
+
+bool CSpreadsheet::save(std::ofstream &ofs, CFileFormat format) const{
     if(!ofs.is_open() || ofs.bad()) {
         return false;
     }
-    if(!save((std::ostream&)ofs)){
+    if(!save((std::ostream&)ofs, format)){
         ofs.close();
         return false;
     }
     ofs.close();
     return true;
 }
-bool CSpreadsheet::save(const std::string& filename) const{
-    std::ofstream ofs(filename);
-    return save(ofs);
+//the file may be the lazily loaded one, so all of it is decoded before it is overwritten
+bool CSpreadsheet::save(const std::string& filename, CFileFormat format) const{
+    materializeAll();
+    std::ofstream ofs(filename, std::ios::binary);
+    return save(ofs, format);
 }
 
 
-//parse expression, build AST from it and store its root in the corresponding cell
-//if a value is to be loaded, turn it into an expression and parse it too
-bool CSpreadsheet::setCell(CPos pos, std::string contents){
-    if(contents.empty()){
-        auto it = cells_.find(pos);
-        if(it != cells_.end())
-            delete it->second;
-        cells_[pos] = nullptr;
-        return true;
-    }
+//parse expression, build AST from it and return a cell holding it, throw std::invalid_argument if it is not valid
+//a value is stored in the cell directly without parsing, so is an expression that was folded into a single constant
+static CCell makeCell(std::string_view contents, CASTBuilder& builder){
+    CCell cell;
+    if(contents.empty())
+        return cell;
     if(contents[0] == '='){
+        CParser(contents, builder).parse();
+        const CNode* ast = builder.getAST();
+        if(const ValNrNode* num = dynamic_cast<const ValNrNode*>(ast))
+            cell.value = num->num_;
+        else if(const ValStrNode* str = dynamic_cast<const ValStrNode*>(ast))
+            cell.value = CBoxedValue(std::string_view(str->str_));
+        else
+            cell.formula = std::make_shared<const CFormula>(ast, builder.arena());
+        return cell;
+    }
+    double number;
+    if(CParser::literalNumber(contents, number))
+        cell.value = number;
+    else
+        cell.value = CBoxedValue(contents);
+    return cell;
+}
+
+static bool isFormula(std::string_view contents){
+    return !contents.empty() && contents[0] == '=';
+}
+
+//a formula is looked up in the formula cache first, so cells set to the same text share the parsed formula
+bool CSpreadsheet::setCell(CPos pos, std::string contents){
+    materializeAt(pos);
+    CCell cell;
+    const CCell* cached = isFormula(contents) ? formula_cache_.find(contents) : nullptr;
+    if(cached)
+        cell = *cached;
+    else{
+        builder_.startBatch();
         try{
-            parseExpression(contents, builder_);
+            cell = makeCell(contents, builder_);
         }
         catch(std::exception& e){
-            std::cerr << e.what();
+            std::cerr << e.what() << std::endl;
             return false;
         }
-        auto it = cells_.find(pos);
-        if(it != cells_.end())
-            delete cells_[pos];
-        cells_[pos] = builder_.getAST();
-        return true;
+        if(isFormula(contents))
+            formula_cache_.insert(contents, cell);
     }
-    std::string expression = "=";
-    for(char c : contents){
-        if(c != '\"')
-            expression.push_back(c);
-        else
-            expression += "\"\"";
+    if(journal_){
+        std::string record;
+        CBinaryWriter writer(record);
+        writer.putByte((unsigned char)CJournalRecord::SetCells);
+        writer.putUnsigned(1);
+        putCell(writer, pos, contents);
+        journal_->append(record);
     }
-    try{
-        parseExpression(contents, builder_);
+    replaceCell(pos, std::move(cell));
+    compactJournal();
+    return true;
+}
+
+//formulas found in the formula cache are taken from it and every other distinct formula of the batch is parsed once,
+//the contents to parse are parsed in chunks by threads_ threads, every thread builds the trees with a builder of its own
+//then the parsed cells are stored in the order of the batch, so a later cell overwrites an earlier one at the same
+//position, and the cells depending on any of them are invalidated at once
+std::vector<std::string> CSpreadsheet::setCells(std::span<const std::pair<CPos, std::string>> contents){
+    constexpr size_t PARSE_CHUNK = 256;
+    for(const auto& content : contents)
+        materializeAt(content.first);
+    std::vector<CCell> parsed(contents.size());
+    std::vector<std::string> errors(contents.size());
+    //index of the first cell of the batch with the same formula for every formula that is not cached
+    std::vector<size_t> source(contents.size());
+    std::unordered_map<std::string_view, size_t> first;
+    std::vector<size_t> to_parse;
+    for(size_t i = 0; i < contents.size(); ++i){
+        source[i] = i;
+        const std::string& text = contents[i].second;
+        if(!isFormula(text)){
+            to_parse.push_back(i);
+            continue;
+        }
+        if(auto it = first.find(text); it != first.end()){
+            source[i] = it->second;
+            continue;
+        }
+        if(const CCell* cached = formula_cache_.find(text)){
+            parsed[i] = *cached;
+            continue;
+        }
+        first.emplace(text, i);
+        to_parse.push_back(i);
     }
-    catch(std::exception& e){
-        std::cerr << e.what();
-        return false;
+    std::vector<CASTBuilder> builders(threads_ - 1);
+    builder_.startBatch();
+    std::vector<size_t> chunks;
+    for(size_t begin = 0; begin < to_parse.size(); begin += PARSE_CHUNK)
+        chunks.push_back(begin);
+    CTaskScheduler scheduler(threads_);
+    scheduler.run(chunks, [&](size_t begin, CTaskScheduler::CWorker& worker){
+        CASTBuilder& builder = worker.id() == 0 ? builder_ : builders[worker.id() - 1];
+        for(size_t k = begin; k < std::min(to_parse.size(), begin + PARSE_CHUNK); ++k){
+            size_t i = to_parse[k];
+            try{
+                parsed[i] = makeCell(contents[i].second, builder);
+            }
+            catch(std::exception& e){
+                errors[i] = e.what();
+            }
+        }
+    });
+    for(size_t i = 0; i < contents.size(); ++i){
+        if(source[i] != i){
+            parsed[i] = parsed[source[i]];
+            errors[i] = errors[source[i]];
+        }
+        else if(errors[i].empty() && first.count(contents[i].second))
+            formula_cache_.insert(contents[i].second, parsed[i]);
     }
-    auto it = cells_.find(pos);
-    if(it != cells_.end())
-        delete it->second;
-    cells_[pos] = builder_.getAST();
-    return true;
+    if(journal_){
+        std::string record;
+        CBinaryWriter writer(record);
+        writer.putByte((unsigned char)CJournalRecord::SetCells);
+        writer.putUnsigned((uint32_t)std::count_if(errors.begin(), errors.end(), [](const std::string& e){ return e.empty(); }));
+        for(size_t i = 0; i < contents.size(); ++i)
+            if(errors[i].empty())
+                putCell(writer, contents[i].first, contents[i].second);
+        journal_->append(record);
+    }
+    std::vector<CPos> stored;
+    stored.reserve(contents.size());
+    for(size_t i = 0; i < contents.size(); ++i)
+        if(errors[i].empty()){
+            const CPos& pos = contents[i].first;
+            updateCycles(pos, storeCell(pos, std::move(parsed[i])));
+            stored.push_back(pos);
+        }
+    invalidate(std::move(stored));
+    compactJournal();
+    return errors;
 }
 
 
-//if cell is empty or if the expression inside contains a cycle return CValue()
-//else evaluate the expression and return the result
+//if cell is empty or if the expression inside depends on a cycle return CValue()
+//else return the value of the expression, evaluating only the cells that are not cached yet
 CValue CSpreadsheet::getValue(CPos pos){
-    auto it = cells_.find(pos);
-    if(it == cells_.end() || it->second == nullptr || hasCycle(it->second))
-        return CValue();
-    return it->second->evaluate(cells_);
+    const CCachedValue* cached = cache_.find(pos);
+    if(!cached){
+        materializeReachable(pos);
+        recalculate(pos);
+        cached = cache_.find(pos);
+        if(!cached)
+            return CValue();
+    }
+    return cached->value.toValue();
+}
+
+//evaluate every dirty cell of the spreadsheet, each of them exactly once
+void CSpreadsheet::recalculate(){
+    materializeAll();
+    if(threads_ > 1){
+        recalculateParallel();
+        return;
+    }
+    recalculateColumns();
+    for(const auto& cell : cells_)
+        if(!cache_.count(cell.first))
+            recalculate(cell.first);
+}
+
+void CSpreadsheet::setThreadCount(unsigned threads){
+    threads_ = std::max(1u, threads);
+}
+
+//evaluate all dirty cells on threads_ threads
+//a cell becomes ready once all dirty cells it references have been evaluated, the ready cells are then evaluated
+//concurrently by the work-stealing scheduler, cells that never become ready lie on a cycle or depend on one
+//the sheet is only read during the evaluation, the results are stored in a separate slot for every dirty cell
+//and moved to the cache afterwards
+void CSpreadsheet::recalculateParallel(){
+    std::vector<CPos> dirty;
+    std::vector<const CCell*> exprs;
+    CGrid<size_t> ids;
+    for(const auto& cell : cells_)
+        if(!cache_.count(cell.first)){
+            ids[cell.first] = dirty.size();
+            dirty.push_back(cell.first);
+            exprs.push_back(&cell.second);
+        }
+    if(dirty.empty())
+        return;
+    std::vector<std::vector<size_t>> dependents(dirty.size());
+    std::vector<std::atomic<size_t>> waiting(dirty.size());
+    std::vector<size_t> ready;
+    std::vector<CPos> refs;
+    for(size_t i = 0; i < dirty.size(); ++i){
+        refs.clear();
+        exprs[i]->collectReferences(refs);
+        for(const CPos& ref : refs){
+            const size_t* id = ids.find(ref);
+            if(!id)
+                continue;
+            dependents[*id].push_back(i);
+            waiting[i].fetch_add(1, std::memory_order_relaxed);
+        }
+        if(waiting[i].load(std::memory_order_relaxed) == 0 && !inCycle(dirty[i]))
+            ready.push_back(i);
+    }
+
+    //reads the values of clean cells from the cache and the values of dirty cells from their result slots
+    struct CBatchEvaluator : public CEvaluator {
+        CBatchEvaluator(const CSpreadsheet& sheet, const CGrid<size_t>& ids,
+                        const std::vector<CCachedValue>& results)
+            : sheet_(sheet), ids_(ids), results_(results) {}
+        CValue valueAt(const CPos& pos) override{
+            return boxedValueAt(pos).toValue();
+        }
+        CBoxedValue boxedValueAt(const CPos& pos) override{
+            const size_t* id = ids_.find(pos);
+            const CCachedValue* res = id ? &results_[*id] : sheet_.cache_.find(pos);
+            if(!res)
+                return CBoxedValue();
+            cycle_found_ = cycle_found_ || res->cyclic;
+            return res->value;
+        }
+        const CSpreadsheet& sheet_;
+        const CGrid<size_t>& ids_;
+        const std::vector<CCachedValue>& results_;
+        bool cycle_found_ = false;
+    };
+
+    std::vector<CCachedValue> results(dirty.size(), {CBoxedValue(), true});
+    CTaskScheduler scheduler(threads_);
+    scheduler.run(ready, [&](size_t task, CTaskScheduler::CWorker& worker){
+        CBatchEvaluator ev(*this, ids, results);
+        CBoxedValue res = exprs[task]->evaluate(ev);
+        results[task] = {ev.cycle_found_ ? CBoxedValue() : std::move(res), ev.cycle_found_};
+        for(size_t dep : dependents[task])
+            if(waiting[dep].fetch_sub(1, std::memory_order_acq_rel) == 1)
+                worker.push(dep);
+    });
+    for(size_t i = 0; i < dirty.size(); ++i)
+        cache_[dirty[i]] = std::move(results[i]);
+}
+
+//minimal number of cells sharing a formula in one column that are evaluated together by the vectorized kernel
+constexpr size_t MIN_COLUMN_RUN = 8;
+
+//evaluate runs of dirty cells lying in consecutive rows of one column that were filled from the same formula
+//and whose offsets differ only by their row - typically a formula copied down by copyRect
+//the i-th reference of all cells of such a run points to the same column and either to the same cell or to rows
+//following each other, so the referenced values are gathered into arrays and the formula is run on all of them at once
+void CSpreadsheet::recalculateColumns(){
+    //check whether the cell at pos is dirty and was filled from the same formula as cell shifted by rows rows
+    auto continues = [this](const CPos& pos, const CCell& cell, int rows){
+        const CCell* other = cells_.find(pos);
+        return other && other->formula == cell.formula && other->col_shift == cell.col_shift
+               && other->row_shift == cell.row_shift + rows && !cache_.count(pos) && !inCycle(pos);
+    };
+    for(const auto& [pos, cell] : cells_){
+        if(cache_.count(pos) || inCycle(pos) || !cell.formula || !cell.formula->program().vectorizable()
+                || continues(CPos(pos.col(), pos.row() - 1), cell, -1))
+            continue;
+        size_t count = 1;
+        while(continues(CPos(pos.col(), pos.row() + (int)count), cell, (int)count))
+            ++count;
+        if(count >= MIN_COLUMN_RUN)
+            evaluateColumn(pos, count);
+    }
 }
 
-//first create a clone of the array that is to be copied
-//then copy cells from the clone so that the original values to be copied are not overwritten in the process
+//evaluate a run of count cells starting at first, a run whose cells reference each other is left to recalculate
+//the cells referenced by the i-th reference of all cells are looked up at once, those not evaluated yet are evaluated
+//first - a value is stored, a formula is recalculated - cells referencing something else than a number and cells whose
+//result is not a number are evaluated one by one, all of them if a cell referenced by every cell is not a number
+void CSpreadsheet::evaluateColumn(const CPos& first, size_t count){
+    const CCell& head = *cells_.find(first);
+    std::vector<CPos> refs, next_refs;
+    head.collectReferences(refs);
+    cells_.find(CPos(first.col(), first.row() + 1))->collectReferences(next_refs);
+    int col = first.col(), row = first.row();
+    std::vector<int> steps(refs.size());
+    for(size_t k = 0; k < refs.size(); ++k){
+        steps[k] = next_refs[k].row() - refs[k].row();
+        int last = refs[k].row() + steps[k] * (int)(count - 1);
+        if(refs[k].col() == col && refs[k].row() <= row + (int)count - 1 && last >= row)
+            return;
+    }
+    std::vector<double> inputs(refs.size() * count);
+    std::vector<double> out(count);
+    std::vector<unsigned char> fallback(count);
+    std::vector<const CCachedValue*> cached(count);
+    std::vector<const CCell*> referenced(count);
+    for(size_t k = 0; k < refs.size(); ++k){
+        //a reference to the same cell from all cells is looked up once
+        size_t lanes = steps[k] == 0 ? 1 : count;
+        std::span<const CCachedValue*> values(cached.data(), lanes);
+        cache_.findColumn(refs[k].col(), refs[k].row(), steps[k], values);
+        if(std::find(values.begin(), values.end(), nullptr) != values.end()){
+            cells_.findColumn(refs[k].col(), refs[k].row(), steps[k], std::span(referenced.data(), lanes));
+            for(size_t i = 0; i < lanes; ++i)
+                if(!values[i] && referenced[i] && referenced[i]->formula)
+                    recalculate(CPos(refs[k].col(), refs[k].row() + steps[k] * (int)i));
+            cache_.assignColumn(refs[k].col(), refs[k].row(), steps[k], lanes, [&](size_t i){
+                return !values[i] && referenced[i] && !referenced[i]->formula
+                       ? std::optional<CCachedValue>({referenced[i]->value, false}) : std::nullopt;
+            });
+            cache_.findColumn(refs[k].col(), refs[k].row(), steps[k], values);
+        }
+        double* column = &inputs[k * count];
+        for(size_t i = 0; i < lanes; ++i){
+            if(values[i] && !values[i]->cyclic && values[i]->value.isNumber())
+                column[i] = values[i]->value.number();
+            else if(steps[k] == 0)
+                std::fill(fallback.begin(), fallback.end(), 1);
+            else
+                fallback[i] = 1;
+        }
+        if(steps[k] == 0)
+            std::fill(column + 1, column + count, column[0]);
+    }
+    head.formula->program().runColumn(inputs.data(), count, out.data(), fallback.data());
+    cache_.assignColumn(col, row, 1, count, [&](size_t i){
+        return fallback[i] ? std::nullopt : std::optional<CCachedValue>({out[i], false});
+    });
+    for(size_t i = 0; i < count; ++i)
+        if(fallback[i])
+            evaluateCell(CPos(col, row + (int)i), cells_.find(CPos(col, row + (int)i)));
+}
+
+//evaluate the cell together with all dirty cells it depends on
+//an iterative DFS over the references visits the dirty precedents and evaluates each of them once it is finished,
+//which yields a topological order - every cell is evaluated after all cells it references
+//cells lying on a cycle are not descended into, they are stored as cyclic and their dependents inherit the flag
+void CSpreadsheet::recalculate(CPos pos){
+    struct CFrame {
+        CPos pos;
+        const CCell* expr;
+        std::vector<CPos> refs;
+        size_t next;
+    };
+    const CCell* cell = cells_.find(pos);
+    if(!cell)
+        return;
+    if(inCycle(pos)){
+        cache_[pos] = {CBoxedValue(), true};
+        return;
+    }
+    std::vector<CFrame> stack;
+    stack.push_back({pos, cell, {}, 0});
+    stack.back().expr->collectReferences(stack.back().refs);
+    while(!stack.empty()){
+        CFrame& top = stack.back();
+        if(top.next == top.refs.size()){
+            evaluateCell(top.pos, top.expr);
+            stack.pop_back();
+            continue;
+        }
+        CPos ref = top.refs[top.next++];
+        if(cache_.count(ref))
+            continue;
+        const CCell* ref_cell = cells_.find(ref);
+        if(!ref_cell)
+            continue;
+        if(inCycle(ref)){
+            cache_[ref] = {CBoxedValue(), true};
+            continue;
+        }
+        stack.push_back({ref, ref_cell, {}, 0});
+        stack.back().expr->collectReferences(stack.back().refs);
+    }
+}
+
+//evaluate the expression of a cell whose precedents have all been evaluated and cache the result
+void CSpreadsheet::evaluateCell(const CPos& pos, const CCell* expr){
+    cycle_found_ = false;
+    CBoxedValue res = expr->evaluate(*this);
+    if(cycle_found_)
+        res = CBoxedValue();
+    cache_[pos] = {std::move(res), cycle_found_};
+    cycle_found_ = false;
+}
+
+//return the value of a cell referenced by the expression that is being evaluated
+//set cycle_found_ if the referenced cell depends on a cycle
+CValue CSpreadsheet::valueAt(const CPos& pos){
+    return boxedValueAt(pos).toValue();
+}
+
+CBoxedValue CSpreadsheet::boxedValueAt(const CPos& pos){
+    const CCachedValue* cached = cache_.find(pos);
+    if(!cached)
+        return CBoxedValue();
+    cycle_found_ = cycle_found_ || cached->cyclic;
+    return cached->value;
+}
+
+//store the new content in the cell, then update the cycles and invalidate the cell
+void CSpreadsheet::replaceCell(CPos pos, CCell cell){
+    bool has_refs = storeCell(pos, std::move(cell));
+    updateCycles(pos, has_refs);
+    invalidate(pos);
+}
+
+//store the new content in the cell, an empty cell clears it, and update the reverse dependency index
+//return true if the new content references any cells
+bool CSpreadsheet::storeCell(CPos pos, CCell cell){
+    std::vector<CPos> refs;
+    const CCell* old = cells_.find(pos);
+    if(old){
+        old->collectReferences(refs);
+        for(const CPos& ref : refs){
+            CCowMap<CPos>* deps = dependents_.modify(ref);
+            if(!deps)
+                continue;
+            deps->erase(dependentKey(pos));
+            if(deps->empty())
+                dependents_.erase(ref);
+        }
+    }
+    bool has_refs = false;
+    if(!cell.empty()){
+        refs.clear();
+        cell.collectReferences(refs);
+        has_refs = !refs.empty();
+        for(const CPos& ref : refs)
+            dependents_[ref].emplace(dependentKey(pos), pos);
+        cells_[pos] = std::move(cell);
+    }
+    else if(old)
+        cells_.erase(pos);
+    return has_refs;
+}
+
+void CSpreadsheet::invalidate(CPos pos){
+    invalidate(std::vector<CPos>{pos});
+}
+
+//remove the cells and all cells transitively depending on them from the cache
+//a dependent that is not cached is already dirty together with its own dependents, so it is not visited again
+void CSpreadsheet::invalidate(std::vector<CPos> stack){
+    for(const CPos& pos : stack)
+        cache_.erase(pos);
+    while(!stack.empty()){
+        CPos cur = stack.back();
+        stack.pop_back();
+        const CCowMap<CPos>* deps = dependents_.find(cur);
+        if(!deps)
+            continue;
+        for(const auto& [key, dep] : *deps)
+            if(cache_.erase(dep))
+                stack.push_back(dep);
+    }
+}
+
+//first take the contents of the array that is to be copied
+//then copy cells from it so that the original values to be copied are not overwritten in the process
+//copying a cell shares its formula and only shifts the offset applied to its relative references
 void CSpreadsheet::copyRect(CPos dst, CPos src, int w, int h){
-    if(dst == src) {
+    if(dst == src || w <= 0 || h <= 0) {
         return;
     }
-    std::map<CPos, CNode*> to_copy;
+    for(int i = 0; i < w; ++i)
+        for(int j = 0; j < h; ++j){
+            materializeAt(CPos(src.col() + i, src.row() + j));
+            materializeAt(CPos(dst.col() + i, dst.row() + j));
+        }
+    //the copy is recorded once the cells it reads are decoded, nothing after that is expected to fail
+    if(journal_){
+        std::string record;
+        CBinaryWriter writer(record);
+        writer.putByte((unsigned char)CJournalRecord::CopyRect);
+        for(int value : {dst.col(), dst.row(), src.col(), src.row(), w, h})
+            writer.putInt(value);
+        journal_->append(record);
+    }
+    std::vector<CCell> to_copy;
+    to_copy.reserve((size_t)w * h);
     for(int i = 0; i < w; ++i) // i is column index
         for(int j = 0; j < h; ++j){ // j is row index
-            CPos from = CPos(src.col() + i, src.row() + j);
-            CNode* expr = nullptr;
-            auto it = cells_.find(from);
-            if(it != cells_.end() && it->second != nullptr){
-                expr = it->second->clone();
-            }
-            to_copy[from] = expr;
+            const CCell* cell = cells_.find(CPos(src.col() + i, src.row() + j));
+            to_copy.push_back(cell ? *cell : CCell());
         }
+    int dc = dst.col() - src.col();
+    int dr = dst.row() - src.row();
     for(int i = 0; i < w; ++i)
         for(int j = 0; j < h; ++j){
-            CPos from = CPos(src.col() + i, src.row() + j);
-            CPos to = CPos(dst.col() + i, dst.row() + j);
-            CNode* expr = nullptr;
-            if(to_copy[from] != nullptr) {
-                expr = to_copy[from]; //no need to clone again
-                expr->shift_references(to.col() - from.col(), to.row() - from.row());
-            }
-            auto it = cells_.find(to);
-            if(it != cells_.end())
-                delete it->second;
-            cells_[to] = expr;
+            CCell cell = std::move(to_copy[(size_t)i * h + j]);
+            cell.col_shift += dc;
+            cell.row_shift += dr;
+            replaceCell(CPos(dst.col() + i, dst.row() + j), std::move(cell));
         }
-
+    compactJournal();
 }
 
-CSpreadsheet::~CSpreadsheet() {
-    for(auto& cell : cells_)
-        delete cell.second;
+CSpreadsheet::~CSpreadsheet() = default;
+
+//the builder holds no state between parsed expressions and the formula cache only speeds up parsing,
+//so neither of them is copied nor moved
+//all other members are copy-on-write, so the copy shares the cells, the cache and the dependency structures
+//with the original and either of them copies only the tiles it modifies and the paths to them afterwards
+CSpreadsheet::CSpreadsheet(const CSpreadsheet &other) : cells_(other.cells_), cache_(other.cache_),
+                                                         dependents_(other.dependents_),
+                                                         cycle_id_(other.cycle_id_), cycles_(other.cycles_),
+                                                         next_cycle_id_(other.next_cycle_id_), threads_(other.threads_),
+                                                         lazy_(other.lazy_), pending_tiles_(other.pending_tiles_){}
+
+//the assigned contents are written as the checkpoint first, so the spreadsheet is left unchanged if it cannot be
+CSpreadsheet& CSpreadsheet::operator =(const CSpreadsheet& src){
+    if(this == &src)
+        return *this;
+    if(journal_)
+        src.writeCheckpoint(*journal_);
+    cells_ = src.cells_;
+    cache_ = src.cache_;
+    dependents_ = src.dependents_;
+    cycle_id_ = src.cycle_id_;
+    cycles_ = src.cycles_;
+    next_cycle_id_ = src.next_cycle_id_;
+    threads_ = src.threads_;
+    lazy_ = src.lazy_;
+    pending_tiles_ = src.pending_tiles_;
+    return *this;
 }
 
-CSpreadsheet::CSpreadsheet(const CSpreadsheet &other){
-    for(auto& cell : other.cells_){
-        cells_[cell.first] = (cell.second ? cell.second->clone() : nullptr);
-    }
+//the formulas keep the arenas of their trees alive, so the cells stay valid without the builder that built them
+//a move only takes the handles of the structures, it neither allocates nor copies any cell
+//the journal stays with neither spreadsheet, its checkpoint and records hold the contents the new one takes over
+CSpreadsheet::CSpreadsheet(CSpreadsheet&& other) noexcept : cells_(std::move(other.cells_)),
+                                                           cache_(std::move(other.cache_)),
+                                                           dependents_(std::move(other.dependents_)),
+                                                           cycle_id_(std::move(other.cycle_id_)),
+                                                           cycles_(std::move(other.cycles_)),
+                                                           next_cycle_id_(std::exchange(other.next_cycle_id_, 0)),
+                                                           threads_(other.threads_), lazy_(std::move(other.lazy_)),
+                                                           pending_tiles_(std::exchange(other.pending_tiles_, {})){
+    other.journal_.reset();
 }
 
-CSpreadsheet& CSpreadsheet::operator =(const CSpreadsheet& src){
+//the journal is kept as by a copy, the spreadsheet moved from stops keeping its own
+CSpreadsheet& CSpreadsheet::operator =(CSpreadsheet&& src){
     if(this == &src)
         return *this;
-    for(auto& cell : cells_)
-        delete cell.second;
-    cells_.clear();
-    for(auto& cell : src.cells_){
-        cells_[cell.first] = (cell.second ? cell.second->clone() : nullptr);
-    }
+    if(journal_)
+        src.writeCheckpoint(*journal_);
+    cells_ = std::move(src.cells_);
+    cache_ = std::move(src.cache_);
+    dependents_ = std::move(src.dependents_);
+    cycle_id_ = std::move(src.cycle_id_);
+    cycles_ = std::move(src.cycles_);
+    next_cycle_id_ = std::exchange(src.next_cycle_id_, 0);
+    threads_ = src.threads_;
+    lazy_ = std::move(src.lazy_);
+    pending_tiles_ = std::exchange(src.pending_tiles_, {});
+    src.journal_.reset();
     return *this;
 }
 
-//run DFS on the expression represented by the AST root in argument and check for oriented cycles
-//return true if a cycle exists in the expression
-bool CSpreadsheet::hasCycle(CNode* expr) const{
-    std::set<CNode*> visited, rec_stack;
-    return expr->hasCycle(visited, rec_stack, cells_);
-}
\ No newline at end of file
+bool CSpreadsheet::inCycle(CPos pos) const{
+    materializeReachable(pos);
+    return cycle_id_.count(pos) != 0;
+}
+
+//return all cells that lie on a cycle of references ordered by their coordinates
+std::vector<CPos> CSpreadsheet::cyclicCells() const{
+    materializeAll();
+    std::vector<CPos> res;
+    for(const auto& cell : cycle_id_)
+        res.push_back(cell.first);
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+//append the coordinates referenced by the expression of the cell to refs
+void CSpreadsheet::references(const CPos& pos, std::vector<CPos>& refs) const{
+    const CCell* cell = cells_.find(pos);
+    if(cell)
+        cell->collectReferences(refs);
+}
+
+//update the cycles after the references of the cell have changed
+//only cycles passing through the cell can be affected - its old component may fall apart into smaller ones,
+//which is resolved by finding the components among its members again, and the new references may close a cycle,
+//in which case the component of the cell consists of the cells both reachable from it and reaching it
+//a cell without references, e.g. one holding a value, cannot close a cycle
+void CSpreadsheet::updateCycles(const CPos& pos, bool has_refs){
+    if(const size_t* old = cycle_id_.find(pos)){
+        size_t id = *old;
+        std::vector<CPos> members = **cycles_.find(id);
+        removeCycle(id);
+        findCycles(members);
+    }
+    if(!has_refs || !reachesItself(pos))
+        return;
+    std::unordered_set<CPos> forward = reachable(pos, true);
+    std::unordered_set<CPos> backward = reachable(pos, false);
+    std::vector<CPos> members;
+    for(const CPos& cell : forward)
+        if(backward.count(cell)){
+            if(const size_t* id = cycle_id_.find(cell))
+                removeCycle(*id);
+            members.push_back(cell);
+        }
+    addCycle(members);
+}
+
+//check whether the cell lies on a cycle by a bidirectional search - the cells referenced by it are expanded
+//alternately with the cells referencing it until the two searches meet or one of them runs out of cells
+//so the cost is bounded by the smaller of the two regions, e.g. a newly added cell with no dependents costs O(1)
+bool CSpreadsheet::reachesItself(const CPos& pos) const{
+    std::unordered_set<CPos> forward_seen, backward_seen;
+    std::vector<CPos> forward, backward;
+    references(pos, forward);
+    const CCowMap<CPos>* deps = dependents_.find(pos);
+    if(deps)
+        for(const auto& [key, dep] : *deps)
+            backward.push_back(dep);
+    while(!forward.empty() && !backward.empty()){
+        CPos cur = forward.back();
+        forward.pop_back();
+        if(cur == pos || backward_seen.count(cur))
+            return true;
+        if(forward_seen.insert(cur).second)
+            references(cur, forward);
+
+        cur = backward.back();
+        backward.pop_back();
+        if(cur == pos || forward_seen.count(cur))
+            return true;
+        if(backward_seen.insert(cur).second){
+            deps = dependents_.find(cur);
+            if(deps)
+                for(const auto& [key, dep] : *deps)
+                    backward.push_back(dep);
+        }
+    }
+    return false;
+}
+
+//return all cells reachable from the cell through references, or through dependents if forward is false
+std::unordered_set<CPos> CSpreadsheet::reachable(const CPos& pos, bool forward) const{
+    std::unordered_set<CPos> seen{pos};
+    std::vector<CPos> stack{pos};
+    std::vector<CPos> next;
+    while(!stack.empty()){
+        CPos cur = stack.back();
+        stack.pop_back();
+        next.clear();
+        if(forward)
+            references(cur, next);
+        else{
+            if(const CCowMap<CPos>* deps = dependents_.find(cur))
+                for(const auto& [key, dep] : *deps)
+                    next.push_back(dep);
+        }
+        for(const CPos& cell : next)
+            if(seen.insert(cell).second)
+                stack.push_back(cell);
+    }
+    return seen;
+}
+
+//find the strongly connected components containing a cycle among the given cells by an iterative Tarjan's algorithm,
+//only references between the given cells are considered
+void CSpreadsheet::findCycles(const std::vector<CPos>& nodes){
+    struct CFrame {
+        CPos pos;
+        std::vector<CPos> refs;
+        size_t next;
+    };
+    struct CState {
+        size_t index;
+        size_t low;
+        bool on_stack;
+    };
+    std::unordered_map<CPos, CState> state;
+    std::unordered_set<CPos> subset(nodes.begin(), nodes.end());
+    std::unordered_set<CPos> self_loops;
+    std::vector<CPos> component_stack;
+    std::vector<CFrame> stack;
+    size_t index = 0;
+    auto visit = [&](const CPos& pos){
+        state[pos] = {index, index, true};
+        ++index;
+        component_stack.push_back(pos);
+        stack.push_back({pos, {}, 0});
+        references(pos, stack.back().refs);
+    };
+    for(const CPos& root : nodes){
+        if(state.count(root))
+            continue;
+        visit(root);
+        while(!stack.empty()){
+            CFrame& top = stack.back();
+            if(top.next < top.refs.size()){
+                CPos ref = top.refs[top.next++];
+                if(ref == top.pos)
+                    self_loops.insert(ref);
+                if(!subset.count(ref))
+                    continue;
+                auto it = state.find(ref);
+                if(it == state.end())
+                    visit(ref);
+                else if(it->second.on_stack)
+                    state[top.pos].low = std::min(state[top.pos].low, it->second.index);
+                continue;
+            }
+            CPos pos = top.pos;
+            stack.pop_back();
+            CState& cur = state[pos];
+            if(!stack.empty()){
+                CState& parent = state[stack.back().pos];
+                parent.low = std::min(parent.low, cur.low);
+            }
+            if(cur.low != cur.index)
+                continue;
+            std::vector<CPos> members;
+            CPos member = pos;
+            do{
+                member = component_stack.back();
+                component_stack.pop_back();
+                state[member].on_stack = false;
+                members.push_back(member);
+            } while(!(member == pos));
+            if(members.size() > 1 || self_loops.count(pos))
+                addCycle(members);
+        }
+    }
+}
+
+//a cell on a cycle is cached as cyclic regardless of the state of the cells it references,
+//so the members of a cycle are invalidated explicitly whenever the cycle appears or disappears
+void CSpreadsheet::addCycle(const std::vector<CPos>& members){
+    size_t id = next_cycle_id_++;
+    for(const CPos& cell : members){
+        cycle_id_[cell] = id;
+        invalidate(cell);
+    }
+    cycles_[id] = std::make_shared<const std::vector<CPos>>(members);
+}
+
+void CSpreadsheet::removeCycle(size_t id){
+    std::shared_ptr<const std::vector<CPos>> members = *cycles_.find(id);
+    cycles_.erase(id);
+    for(const CPos& cell : *members){
+        cycle_id_.erase(cell);
+        invalidate(cell);
+    }
+}
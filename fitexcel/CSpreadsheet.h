@@ -34,6 +34,11 @@
 #include <span>
 #include <utility>
 #include "CASTBuilder.h"
+#include "CCowMap.h"
+#include "CFormula.h"
+#include "CFormulaCache.h"
+#include "CGrid.h"
+#include "CJournal.h"
 
 using namespace std::literals;
 using CValue = std::variant<std::monostate, double, std::string>;
@@ -45,12 +50,29 @@ constexpr unsigned SPREADSHEET_FILE_IO = 0x04;
 constexpr unsigned SPREADSHEET_SPEED = 0x08;
 constexpr unsigned SPREADSHEET_PARSER = 0x10;
 
+//format of a saved spreadsheet, the text format stores the expression of every cell and is parsed when loading,
+//the binary format stores the compiled formulas and the cells referring to them, so it is only decoded,
+//the compressed format is the binary one coded more densely and compressed, it is always loaded eagerly
+enum class CFileFormat {
+    Text,
+    Binary,
+    Compressed
+};
+
+//an eager load decodes the whole file at once, a lazy load maps a binary file into memory and reads only its index,
+//the cells of a tile are decoded when they are first needed
+enum class CLoadMode {
+    Eager,
+    Lazy
+};
+
+class CLazyFile;
 
 
-class CSpreadsheet {
+class CSpreadsheet : private CEvaluator {
 public:
     static unsigned capabilities() {
-        return SPREADSHEET_CYCLIC_DEPS | /*SPREADSHEET_FUNCTIONS |*/ SPREADSHEET_FILE_IO | SPREADSHEET_SPEED/* | SPREADSHEET_PARSER*/;
+        return SPREADSHEET_CYCLIC_DEPS | /*SPREADSHEET_FUNCTIONS |*/ SPREADSHEET_FILE_IO | SPREADSHEET_SPEED | SPREADSHEET_PARSER;
     }
 
     CSpreadsheet();
@@ -61,31 +83,153 @@ public:
 
     CSpreadsheet& operator =(const CSpreadsheet& src);
 
+    //the spreadsheet moved from is left empty and stops keeping its journal
+    CSpreadsheet(CSpreadsheet&& other) noexcept;
+
+    //a spreadsheet keeping a journal writes the assigned contents as its new checkpoint, like a copy assignment, and
+    //throws std::runtime_error without a change if it cannot
+    CSpreadsheet& operator =(CSpreadsheet&& src);
+
+    //the format of the loaded data is recognized by its first bytes
     bool load(std::istream &is);
     bool load(std::ifstream &ifs);
     bool load(const std::string& filename);
-
-    bool save(std::ostream &os) const;
-    bool save(std::ofstream &ofs) const;
-    bool save(const std::string& filename) const;
+    //a file that cannot be loaded lazily, because it is not a binary file of version 3, is loaded eagerly
+    //the blocks of a lazily loaded file are verified when they are decoded, an operation needing a damaged tile
+    //throws std::runtime_error, so does one needing a tile of a file that was modified before all tiles were decoded,
+    //also by a save of a copy of the spreadsheet, which shares the file
+    bool load(const std::string& filename, CLoadMode mode);
+
+    //decode all cells of a lazily loaded file that were not needed yet
+    void materialize();
+
+    bool save(std::ostream &os, CFileFormat format = CFileFormat::Text) const;
+    bool save(std::ofstream &ofs, CFileFormat format = CFileFormat::Text) const;
+    bool save(const std::string& filename, CFileFormat format = CFileFormat::Text) const;
+
+    //keep the spreadsheet in the checkpoint file and a journal of its later changes, filename.journal, so a save
+    //only appends the change made instead of rewriting the whole file
+    //if the checkpoint exists, the spreadsheet is loaded from it and the records of the journal are replayed,
+    //otherwise the contents of the spreadsheet are written as the first checkpoint
+    //setCell, setCells and copyRect then append their changes to the journal and a load or an assignment writes a new
+    //checkpoint, an operation that cannot write to the journal throws std::runtime_error and makes no change, a load
+    //that cannot write the checkpoint returns false
+    //return false if the checkpoint or the journal cannot be read or written, the journal kept before is then kept
+    bool openJournal(const std::string& filename, uint64_t min_journal_size = JOURNAL_MIN_SIZE);
+
+    //compact the journal into a new checkpoint, it is done whenever the journal grows larger than the checkpoint
+    void checkpoint();
+
+    //stop appending the changes to the journal, the files are left as they are
+    void closeJournal();
 
     bool setCell(CPos pos,
                  std::string contents);
 
+    //set the contents of many cells at once, the formulas are parsed on threads_ threads
+    //return the error message of every cell that could not be parsed and was left unchanged, empty for the others
+    std::vector<std::string> setCells(std::span<const std::pair<CPos, std::string>> contents);
+
     CValue getValue(CPos pos);
 
+    //evaluate all cells whose values are not up to date, getValue then only reads the stored results
+    void recalculate();
+
+    //set the number of threads used by recalculate, setCells and the load of a text file, 1 (the default) uses only
+    //the calling thread
+    void setThreadCount(unsigned threads);
+
     void copyRect(CPos dst,
                   CPos src,
                   int w = 1,
                   int h = 1);
 
-    bool hasCycle(CNode* expr) const;
+    //return true if the cell lies on a cycle of references, the answer is maintained by setCell and copyRect
+    bool inCycle(CPos pos) const;
 
-    const std::map<CPos, CNode*>& cells() const { return cells_; }
+    //return all cells that lie on a cycle of references
+    std::vector<CPos> cyclicCells() const;
+
+    const CGrid<CCell>& cells() const {
+        materializeAll();
+        return cells_;
+    }
+
+    //cache of parsed formulas shared by setCell and setCells, its counters show how often a formula was reused
+    const CFormulaCache& formulaCache() const { return formula_cache_; }
+    //set the maximal number of formulas kept in the cache, 0 disables it
+    void setFormulaCacheCapacity(size_t capacity){ formula_cache_.setCapacity(capacity); }
 
 private:
-    std::map<CPos, CNode*> cells_;
+    //result of an evaluation of a cell, cyclic is set if the cell depends on a cycle
+    struct CCachedValue {
+        CBoxedValue value;
+        bool cyclic;
+    };
+
+    bool loadText(std::istream& is);
+    bool loadTextPipelined(std::istream& is);
+    bool loadLegacyText(std::istream& is);
+    bool loadBinary(std::istream& is);
+    bool saveText(std::ostream& os) const;
+    bool saveBinary(std::ostream& os) const;
+    bool saveCompressed(std::ostream& os) const;
+    bool takeLoaded(CSpreadsheet&& loaded);
+    void materializeAt(const CPos& pos);
+    void materializeTile(uint64_t key);
+    void materializeReachable(const CPos& pos) const;
+    void materializeAll() const;
+    void compactJournal();
+    void writeCheckpoint(CJournal& journal) const;
+    bool replay(std::string_view record);
+    CValue valueAt(const CPos& pos) override;
+    CBoxedValue boxedValueAt(const CPos& pos) override;
+    void recalculate(CPos pos);
+    void recalculateParallel();
+    void recalculateColumns();
+    void evaluateColumn(const CPos& first, size_t count);
+    void evaluateCell(const CPos& pos, const CCell* expr);
+    void replaceCell(CPos pos, CCell cell);
+    bool storeCell(CPos pos, CCell cell);
+    void invalidate(CPos pos);
+    void invalidate(std::vector<CPos> stack);
+    void references(const CPos& pos, std::vector<CPos>& refs) const;
+    void updateCycles(const CPos& pos, bool has_refs);
+    bool reachesItself(const CPos& pos) const;
+    std::unordered_set<CPos> reachable(const CPos& pos, bool forward) const;
+    void findCycles(const std::vector<CPos>& nodes);
+    void addCycle(const std::vector<CPos>& members);
+    void removeCycle(size_t id);
+    static uint64_t dependentKey(const CPos& pos){
+        return ((uint64_t)(uint32_t)pos.col() << 32) | (uint32_t)pos.row();
+    }
+
+    CGrid<CCell> cells_;
     CASTBuilder builder_;
+    CFormulaCache formula_cache_;
+    //evaluated cells, every cell missing from the cache is dirty and so are all its dependents
+    CGrid<CCachedValue> cache_;
+    //reverse dependency index, maps a cell to the set of cells whose expressions reference it keyed by dependentKey,
+    //the sets are copy-on-write too, so an edit of a copy does not copy all dependents of a cell it references
+    CGrid<CCowMap<CPos>> dependents_;
+    //strongly connected components of the reference graph that contain a cycle, every cell lying on a cycle
+    //is mapped to the identifier of its component
+    CGrid<size_t> cycle_id_;
+    //members of every cycle by its identifier, shared so a leaf of the map copied on write does not copy them
+    CCowMap<std::shared_ptr<const std::vector<CPos>>> cycles_;
+    size_t next_cycle_id_ = 0;
+    //set while evaluating a cell if it depends on a cycle
+    bool cycle_found_ = false;
+    unsigned threads_ = 1;
+    //file of a lazily loaded spreadsheet and the keys of its tiles that were not decoded yet, cells of the other tiles
+    //are stored in cells_, the file is released once all its tiles are decoded
+    //every cell a cached value depends on is stored, so the evaluation of a cell whose reachable cells were decoded
+    //never meets an undecoded cell
+    std::shared_ptr<CLazyFile> lazy_;
+    std::unordered_set<uint64_t> pending_tiles_;
+    //journal of the changes, it belongs to this spreadsheet only, so it is neither copied nor moved, the contents
+    //assigned to a spreadsheet keeping a journal are written as its new checkpoint
+    std::unique_ptr<CJournal> journal_;
 };
 
 
@@ -0,0 +1,98 @@
+#ifndef CTaskScheduler_h
+#define CTaskScheduler_h
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//work-stealing scheduler running tasks identified by indices on several threads
+//every worker owns a deque of ready tasks, it takes tasks from the back of its own deque and when it runs out of work,
+//it steals from the front of the deques of the other workers
+//tasks may make other tasks ready while running, the scheduler finishes once no task is ready or running
+class CTaskScheduler {
+public:
+    explicit CTaskScheduler(unsigned workers) : queues_(workers > 0 ? workers : 1) {}
+
+    //handle passed to a running task, used to schedule tasks that became ready
+    class CWorker {
+    public:
+        void push(size_t task){
+            scheduler_.pending_.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(scheduler_.queues_[id_].mutex);
+            scheduler_.queues_[id_].tasks.push_back(task);
+        }
+        //index of the worker, worker 0 runs on the thread that called run
+        unsigned id() const{
+            return id_;
+        }
+    private:
+        friend class CTaskScheduler;
+        CWorker(CTaskScheduler& scheduler, unsigned id) : scheduler_(scheduler), id_(id) {}
+        CTaskScheduler& scheduler_;
+        unsigned id_;
+    };
+
+    //run the initial tasks and all tasks they make ready, fn is called as fn(task, worker)
+    //returns after all tasks have finished
+    template<typename F>
+    void run(const std::vector<size_t>& initial, F&& fn){
+        for(size_t i = 0; i < initial.size(); ++i)
+            queues_[i % queues_.size()].tasks.push_back(initial[i]);
+        pending_ = initial.size();
+        std::vector<std::jthread> threads;
+        for(unsigned id = 1; id < queues_.size(); ++id)
+            threads.emplace_back([this, &fn, id]{ work(id, fn); });
+        work(0, fn);
+    }
+
+private:
+    struct CQueue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    template<typename F>
+    void work(unsigned id, F& fn){
+        CWorker worker(*this, id);
+        size_t task;
+        while(pending_.load(std::memory_order_acquire) != 0){
+            if(!pop(id, task) && !steal(id, task)){
+                std::this_thread::yield();
+                continue;
+            }
+            fn(task, worker);
+            pending_.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+
+    bool pop(unsigned id, size_t& task){
+        std::lock_guard<std::mutex> lock(queues_[id].mutex);
+        if(queues_[id].tasks.empty())
+            return false;
+        task = queues_[id].tasks.back();
+        queues_[id].tasks.pop_back();
+        return true;
+    }
+
+    bool steal(unsigned id, size_t& task){
+        for(size_t i = 1; i < queues_.size(); ++i){
+            CQueue& victim = queues_[(id + i) % queues_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(victim.tasks.empty())
+                continue;
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<CQueue> queues_;
+    //number of tasks that are ready or running
+    std::atomic<size_t> pending_ = 0;
+};
+
+#endif /* CTaskScheduler_h */
@@ -0,0 +1,86 @@
+#ifndef CValue_h
+#define CValue_h
+
+#include <cmath>
+#include <string>
+#include <variant>
+#include "CPos.h"
+
+using CValue = std::variant<std::monostate, double, std::string>;
+
+//operations on cell values shared by all evaluators of expressions
+//an operation on operands of unsupported types results in an empty value
+
+inline CValue addValues(const CValue& left, const CValue& right){
+    if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
+        return std::get<double>(left) + std::get<double>(right);
+    if(std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right))
+        return std::get<std::string>(left) + std::get<std::string>(right);
+    return CValue();
+}
+
+inline CValue subValues(const CValue& left, const CValue& right){
+    if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
+        return std::get<double>(left) - std::get<double>(right);
+    return CValue();
+}
+
+inline CValue mulValues(const CValue& left, const CValue& right){
+    if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
+        return std::get<double>(left) * std::get<double>(right);
+    return CValue();
+}
+
+inline CValue divValues(const CValue& left, const CValue& right){
+    if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right) && std::get<double>(right) != 0)
+        return std::get<double>(left) / std::get<double>(right);
+    return CValue();
+}
+
+inline CValue powValues(const CValue& left, const CValue& right){
+    if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
+        return pow(std::get<double>(left), std::get<double>(right));
+    return CValue();
+}
+
+inline CValue negValue(const CValue& child){
+    if(std::holds_alternative<double>(child))
+        return -std::get<double>(child);
+    return CValue();
+}
+
+inline CValue eqValues(const CValue& left, const CValue& right){
+    return (left == right) * 1.0;
+}
+
+inline CValue neValues(const CValue& left, const CValue& right){
+    return (left != right) * 1.0;
+}
+
+//numbers and strings can be ordered among themselves, cmp is applied to operands of the same type
+template<typename Cmp>
+CValue compareValues(const CValue& left, const CValue& right, Cmp cmp){
+    if(std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
+        return cmp(std::get<double>(left), std::get<double>(right)) * 1.0;
+    if(std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right))
+        return cmp(std::get<std::string>(left), std::get<std::string>(right)) * 1.0;
+    return CValue();
+}
+
+inline CValue ltValues(const CValue& left, const CValue& right){
+    return compareValues(left, right, [](const auto& a, const auto& b){ return a < b; });
+}
+
+inline CValue leValues(const CValue& left, const CValue& right){
+    return compareValues(left, right, [](const auto& a, const auto& b){ return a <= b; });
+}
+
+inline CValue gtValues(const CValue& left, const CValue& right){
+    return compareValues(left, right, [](const auto& a, const auto& b){ return a > b; });
+}
+
+inline CValue geValues(const CValue& left, const CValue& right){
+    return compareValues(left, right, [](const auto& a, const auto& b){ return a >= b; });
+}
+
+#endif /* CValue_h */
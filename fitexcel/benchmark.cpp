@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "CParser.h"
+#include "CSpreadsheet.h"
+
+
+//measure the time taken by fn in seconds
+template<typename F>
+double measure(F&& fn){
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void report(const std::string& name, size_t items, const std::string& unit, double seconds){
+    std::cout << name << ": " << seconds * 1000 << " ms, " << (size_t)(items / seconds) << " " << unit << "/s" << std::endl;
+}
+
+
+//evaluator returning a number derived from the coordinates for every referenced cell
+struct CFakeEvaluator : public CEvaluator {
+    CValue valueAt(const CPos& pos) override{
+        return (double)(pos.col() + pos.row() % 7);
+    }
+    CBoxedValue boxedValueAt(const CPos& pos) override{
+        return (double)(pos.col() + pos.row() % 7);
+    }
+};
+
+//evaluate the same set of formulas by walking their ASTs and by running their compiled programs
+void benchmarkEvaluation(){
+    const std::vector<std::string> shapes = {
+        "=A1*2+B1/3-C1^2",
+        "=($A$1+B2)*(C3-D4)/(E5+1)",
+        "=-A1+B1*B1-C1*C1+D1*D1-E1",
+        "=A1<B1",
+        "=(A1+1)*(A2+2)*(A3+3)*(A4+4)*(A5+5)*(A6+6)",
+    };
+    const size_t count = 200000;
+    const size_t rounds = 10;
+    CASTBuilder builder;
+    std::vector<std::unique_ptr<const CFormula>> formulas;
+    formulas.reserve(count);
+    for(size_t i = 0; i < count; ++i){
+        CParser(shapes[i % shapes.size()], builder).parse();
+        formulas.push_back(std::make_unique<const CFormula>(builder.getAST(), builder.arena()));
+    }
+    CFakeEvaluator ev;
+    double sum_tree = 0, sum_vm = 0;
+    double tree = measure([&]{
+        for(size_t r = 0; r < rounds; ++r)
+            for(const auto& formula : formulas){
+                CValue res = formula->ast()->evaluate(ev);
+                if(std::holds_alternative<double>(res))
+                    sum_tree += std::get<double>(res);
+            }
+    });
+    double vm = measure([&]{
+        for(size_t r = 0; r < rounds; ++r)
+            for(const auto& formula : formulas){
+                CBoxedValue res = formula->evaluate(ev);
+                if(res.isNumber())
+                    sum_vm += res.number();
+            }
+    });
+    if(sum_tree != sum_vm)
+        std::cout << "results of the tree-walk and the VM differ" << std::endl;
+    report("tree-walk evaluation", count * rounds, "formulas", tree);
+    report("bytecode VM evaluation", count * rounds, "formulas", vm);
+}
+
+//parse the same formulas with the prebuilt parser library and with the native parser, both build the same trees
+void benchmarkParsing(){
+    const int count = 200000;
+    std::vector<std::string> formulas;
+    formulas.reserve(count);
+    for(int i = 1; i <= count; ++i)
+        formulas.push_back("=($A$1+B" + std::to_string(i) + ")*(C" + std::to_string(i % 100 + 1)
+                           + "-2.5e-1)/(\"label\"<>D" + std::to_string(i) + ")^2+-E$3");
+    CASTBuilder library_builder, native_builder;
+    std::vector<const CNode*> library_trees, native_trees;
+    library_trees.reserve(count);
+    native_trees.reserve(count);
+    double library = measure([&]{
+        for(const std::string& formula : formulas){
+            parseExpression(formula, library_builder);
+            library_trees.push_back(library_builder.getAST());
+        }
+    });
+    double native = measure([&]{
+        for(const std::string& formula : formulas){
+            CParser(formula, native_builder).parse();
+            native_trees.push_back(native_builder.getAST());
+        }
+    });
+    for(int i = 0; i < count; i += 1000)
+        if(library_trees[i]->reconstruct(0, 0) != native_trees[i]->reconstruct(0, 0))
+            std::cout << "trees built by the library and the native parser differ" << std::endl;
+    report("library parser", count, "formulas", library);
+    report("native parser", count, "formulas", native);
+}
+
+//import a block of raw numbers and texts, as when loading data exported from another program
+void benchmarkImport(){
+    const int rows = 100000;
+    const int cols = 5;
+    std::vector<std::string> values;
+    values.reserve((size_t)rows * cols);
+    for(int row = 1; row <= rows; ++row)
+        for(int col = 1; col <= cols; ++col)
+            values.push_back(col == cols ? "item " + std::to_string(row) : std::to_string(row * col) + ".5");
+    CSpreadsheet sheet;
+    double seconds = measure([&]{
+        size_t i = 0;
+        for(int row = 1; row <= rows; ++row)
+            for(int col = 1; col <= cols; ++col)
+                sheet.setCell(CPos(col, row), values[i++]);
+    });
+    report("literal import", values.size(), "cells", seconds);
+}
+
+//set a block of distinct formulas cell by cell and as one batch parsed on several threads
+void benchmarkBatch(){
+    const int rows = 100000;
+    std::vector<std::pair<CPos, std::string>> batch;
+    batch.reserve(rows);
+    for(int row = 1; row <= rows; ++row)
+        batch.emplace_back(CPos(1, row), "=(B" + std::to_string(row) + "+" + std::to_string(row) + ")*$C$1-D"
+                                         + std::to_string(row + 1) + "^2/(E" + std::to_string(row) + "+1)");
+    CSpreadsheet single;
+    double cell_by_cell = measure([&]{
+        for(const auto& [pos, contents] : batch)
+            single.setCell(pos, contents);
+    });
+    report("setCell", rows, "cells", cell_by_cell);
+    for(unsigned threads : {1u, 4u}){
+        CSpreadsheet sheet;
+        sheet.setThreadCount(threads);
+        double seconds = measure([&]{ sheet.setCells(batch); });
+        report("setCells on " + std::to_string(threads) + " threads", rows, "cells", seconds);
+    }
+}
+
+//set many cells to a few repeated formulas with the formula cache disabled and enabled
+void benchmarkFormulaCache(){
+    const int rows = 100000;
+    const std::vector<std::string> shapes = {"=$A$1*0.21", "=($B$1+$B$2)/2", "=$C$1^2-$C$2*4"};
+    for(size_t capacity : {(size_t)0, CFormulaCache::DEFAULT_CAPACITY}){
+        CSpreadsheet sheet;
+        sheet.setFormulaCacheCapacity(capacity);
+        double seconds = measure([&]{
+            for(int row = 1; row <= rows; ++row)
+                sheet.setCell(CPos(4, row), shapes[row % shapes.size()]);
+        });
+        report("repeated formulas, cache capacity " + std::to_string(capacity), rows, "cells", seconds);
+    }
+}
+
+//look up every cell of a dense block in a std::map ordered by the coordinates and in the tiled grid
+void benchmarkLookup(){
+    const int cols = 50, rows = 20000;
+    const size_t rounds = 5;
+    std::map<CPos, double> map;
+    CGrid<double> grid;
+    for(int col = 1; col <= cols; ++col)
+        for(int row = 1; row <= rows; ++row){
+            map[CPos(col, row)] = col + row;
+            grid[CPos(col, row)] = col + row;
+        }
+    double sum_map = 0, sum_grid = 0;
+    double ordered = measure([&]{
+        for(size_t r = 0; r < rounds; ++r)
+            for(int row = 1; row <= rows; ++row)
+                for(int col = 1; col <= cols; ++col)
+                    sum_map += map.find(CPos(col, row))->second;
+    });
+    double tiled = measure([&]{
+        for(size_t r = 0; r < rounds; ++r)
+            for(int row = 1; row <= rows; ++row)
+                for(int col = 1; col <= cols; ++col)
+                    sum_grid += *grid.find(CPos(col, row));
+    });
+    if(sum_map != sum_grid)
+        std::cout << "results of the map and the grid lookups differ" << std::endl;
+    report("std::map lookup", (size_t)cols * rows * rounds, "lookups", ordered);
+    report("tiled grid lookup", (size_t)cols * rows * rounds, "lookups", tiled);
+}
+
+//fill a formula down a column and evaluate it cell by cell through getValue and at once by recalculate,
+//which evaluates the filled column by the vectorized kernel, the values it stored are read back separately
+void benchmarkFillDown(){
+    const int rows = 200000;
+    auto build = [rows]{
+        CSpreadsheet sheet;
+        for(int row = 1; row <= rows; ++row){
+            sheet.setCell(CPos(1, row), std::to_string(row % 97 + 1));
+            sheet.setCell(CPos(3, row), std::to_string(row % 13 + 1));
+        }
+        sheet.setCell(CPos("B1"), "=A1*C1+A1/3-C1*2+$A$1");
+        for(int filled = 1; filled < rows; filled *= 2)
+            sheet.copyRect(CPos(2, filled + 1), CPos("B1"), 1, std::min(filled, rows - filled));
+        return sheet;
+    };
+    CSpreadsheet lazy = build(), vectorized = build();
+    double sum_lazy = 0, sum_vectorized = 0;
+    double per_cell = measure([&]{
+        for(int row = 1; row <= rows; ++row)
+            sum_lazy += std::get<double>(lazy.getValue(CPos(2, row)));
+    });
+    double column = measure([&]{
+        vectorized.recalculate();
+    });
+    double read = measure([&]{
+        for(int row = 1; row <= rows; ++row)
+            sum_vectorized += std::get<double>(vectorized.getValue(CPos(2, row)));
+    });
+    if(sum_lazy != sum_vectorized)
+        std::cout << "results of the per-cell and the vectorized evaluation differ" << std::endl;
+    report("fill-down per-cell evaluation", rows, "cells", per_cell);
+    report("fill-down vectorized recalculation", rows, "cells", column);
+    report("fill-down reading of the recalculated values", rows, "cells", read);
+}
+
+//evaluate formulas reading long strings from other cells, a read only shares the buffer of the string
+void benchmarkStrings(){
+    const int rows = 200000;
+    CSpreadsheet sheet;
+    for(int row = 1; row <= rows; ++row){
+        sheet.setCell(CPos(1, row), "a string longer than the small string buffer " + std::to_string(row % 10));
+        sheet.setCell(CPos(2, row), "=A" + std::to_string(row) + "<A" + std::to_string(row % rows + 1));
+    }
+    double seconds = measure([&]{ sheet.recalculate(); });
+    report("string comparisons", rows, "cells", seconds);
+}
+
+//build a label by appending to the label of the cell above, every concatenation shares the string it extends
+void benchmarkConcatenation(){
+    const int rows = 20000;
+    CSpreadsheet sheet;
+    sheet.setCell(CPos(1, 1), "label");
+    for(int row = 2; row <= rows; ++row)
+        sheet.setCell(CPos(1, row), "=A" + std::to_string(row - 1) + "+\", item " + std::to_string(row) + "\"");
+    double seconds = measure([&]{
+        sheet.recalculate();
+        sheet.getValue(CPos(1, rows));
+    });
+    report("string concatenation chain", rows, "cells", seconds);
+}
+
+//build a sheet of distinct formulas, copy it and destroy both copies
+//the nodes of the formulas live in arenas shared by consecutive formulas, an arena is released with its last formula
+void benchmarkSheetLifetime(){
+    const int rows = 100000;
+    auto sheet = std::make_unique<CSpreadsheet>();
+    double build = measure([&]{
+        for(int row = 1; row <= rows; ++row)
+            sheet->setCell(CPos(1, row), "=(A" + std::to_string(row + 1) + "+" + std::to_string(row)
+                                         + ")*(B1-$C$2)/(D" + std::to_string(row) + "^3+1)<>\"x\"");
+    });
+    std::unique_ptr<CSpreadsheet> copy;
+    double copying = measure([&]{ copy = std::make_unique<CSpreadsheet>(*sheet); });
+    //the copy shares its tiles and the sets of dependents with the original, an edit copies only the paths to what
+    //it touches
+    const int edits = 100;
+    double editing = measure([&]{
+        for(int i = 1; i <= edits; ++i)
+            copy->setCell(CPos(1, i * (rows / edits)), std::to_string(i));
+    });
+    double destroy = measure([&]{
+        sheet.reset();
+        copy.reset();
+    });
+    report("sheet build", rows, "formulas", build);
+    report("sheet copy", rows, "formulas", copying);
+    report("edits of the copy", edits, "edits", editing);
+    report("sheet destruction", rows, "formulas", destroy);
+}
+
+//build a sparse sheet of cells in separate tiles and pairs of cells referencing each other, then take a copy of it
+//before every edit, the copy shares the tries of tiles and cycles, so an edit copies only the paths to what it touches
+void benchmarkSparseCopy(){
+    const int cells = 100000, cycles = 2000, edits = 1000;
+    const int spread = CGrid<double>::TILE_SIZE;
+    CSpreadsheet sheet;
+    double build = measure([&]{
+        for(int i = 0; i < cells; ++i)
+            sheet.setCell(CPos(1 + spread * (i % 300), 1 + spread * (i / 300)), std::to_string(i));
+        for(int i = 0; i < cycles; ++i){
+            sheet.setCell(CPos(702, 1 + 2 * i), "=ZZ" + std::to_string(2 + 2 * i));
+            sheet.setCell(CPos(702, 2 + 2 * i), "=ZZ" + std::to_string(1 + 2 * i));
+        }
+    });
+    std::vector<CSpreadsheet> copies;
+    copies.reserve(edits);
+    double editing = measure([&]{
+        for(int i = 0; i < edits; ++i){
+            copies.push_back(sheet);
+            copies.back().setCell(CPos(1 + spread * (i % 300), 1 + spread * (i / 300)),
+                                  "=ZZ" + std::to_string(2 + 2 * i));
+            copies.back().setCell(CPos(702, 1 + 2 * i), std::to_string(i));
+        }
+    });
+    report("sparse sheet build", cells, "cells", build);
+    report("copies and edits of the sparse sheet", edits, "edits", editing);
+}
+
+//save a sheet of values, filled-down formulas and distinct formulas in every format and load it back
+void benchmarkFileFormats(){
+    const int rows = 100000;
+    CSpreadsheet sheet;
+    for(int row = 1; row <= rows; ++row){
+        sheet.setCell(CPos(1, row), std::to_string(row % 97 + 1) + ".25");
+        sheet.setCell(CPos(2, row), "item " + std::to_string(row));
+        sheet.setCell(CPos(4, row), "=A" + std::to_string(row) + "*" + std::to_string(row % 89) + "+$A$1");
+    }
+    sheet.setCell(CPos("C1"), "=A1*1.2+(A1-$A$1)/2");
+    for(int filled = 1; filled < rows; filled *= 2)
+        sheet.copyRect(CPos(3, filled + 1), CPos("C1"), 1, std::min(filled, rows - filled));
+    size_t cells = sheet.cells().size();
+    for(CFileFormat format : {CFileFormat::Text, CFileFormat::Binary, CFileFormat::Compressed}){
+        std::string name = format == CFileFormat::Text ? "text"
+                           : format == CFileFormat::Binary ? "binary" : "compressed";
+        std::ostringstream os;
+        double saving = measure([&]{ sheet.save(os, format); });
+        std::string data = os.str();
+        std::istringstream is(data);
+        CSpreadsheet loaded;
+        double loading = measure([&]{ loaded.load(is); });
+        if(loaded.cells().size() != cells)
+            std::cout << "the " << name << " file was not loaded completely" << std::endl;
+        double megabytes = data.size() / 1e6;
+        std::cout << name << " file: " << data.size() << " bytes, " << data.size() / cells << " bytes/cell, save "
+                  << megabytes / saving << " MB/s, load " << megabytes / loading << " MB/s" << std::endl;
+        report(name + " save", cells, "cells", saving);
+        report(name + " load", cells, "cells", loading);
+    }
+}
+
+//a lazy load reads only the index of the file, so opening it and reading a few cells does not depend on its size
+void benchmarkLazyLoad(){
+    const int rows = 200000;
+    const int queries = 500;
+    std::string filename = "benchmark_lazy.bin";
+    {
+        CSpreadsheet sheet;
+        sheet.setCell(CPos("A1"), "1.5");
+        sheet.setCell(CPos("B1"), "=A1*2+$A$1");
+        for(int row = 2; row <= rows; ++row){
+            sheet.setCell(CPos(1, row), std::to_string(row % 97) + ".5");
+            sheet.setCell(CPos(3, row), "text " + std::to_string(row));
+        }
+        for(int filled = 1; filled < rows; filled *= 2)
+            sheet.copyRect(CPos(2, filled + 1), CPos("B1"), 1, std::min(filled, rows - filled));
+        sheet.save(filename, CFileFormat::Binary);
+    }
+    for(CLoadMode mode : {CLoadMode::Eager, CLoadMode::Lazy}){
+        std::string name = mode == CLoadMode::Eager ? "eager" : "lazy";
+        CSpreadsheet loaded;
+        double opening = measure([&]{ loaded.load(filename, mode); });
+        double sum = 0;
+        double querying = measure([&]{
+            for(int i = 0; i < queries; ++i){
+                CValue value = loaded.getValue(CPos(2, 1 + (int)((long long)i * 7919 % rows)));
+                if(std::holds_alternative<double>(value))
+                    sum += std::get<double>(value);
+            }
+        });
+        std::cout << name << " load: open " << opening * 1e3 << " ms, " << queries << " queries " << querying * 1e3
+                  << " ms (sum " << sum << ")" << std::endl;
+    }
+    std::remove(filename.c_str());
+}
+
+//throughput of the load of a text file, the sequential load with one thread, the pipelined one with more of them
+void benchmarkPipelinedLoad(){
+    const int rows = 100000;
+    CSpreadsheet sheet;
+    std::vector<std::pair<CPos, std::string>> contents;
+    for(int row = 1; row <= rows; ++row){
+        contents.emplace_back(CPos(1, row), std::to_string(row % 97) + ".5");
+        contents.emplace_back(CPos(2, row), "=A" + std::to_string(row) + "*" + std::to_string(row % 89) + "+$A$1/2");
+        contents.emplace_back(CPos(3, row), "item " + std::to_string(row));
+    }
+    sheet.setCells(contents);
+    std::ostringstream os;
+    sheet.save(os);
+    std::string data = os.str();
+    size_t records = sheet.cells().size();
+    for(unsigned threads : {1u, 2u, 4u, 8u, 16u}){
+        CSpreadsheet loaded;
+        loaded.setThreadCount(threads);
+        std::istringstream is(data);
+        double seconds = measure([&]{ loaded.load(is); });
+        if(loaded.cells().size() != records)
+            std::cout << "the text file was not loaded completely" << std::endl;
+        report("text load with " + std::to_string(threads) + " threads", records, "records", seconds);
+    }
+}
+
+//saving the whole sheet after every edit costs time proportional to the sheet, appending the edit to a journal costs
+//time proportional to the edit
+void benchmarkJournal(){
+    const int rows = 100000;
+    const int saves = 20;
+    const int edits = 200;
+    std::string filename = "benchmark_journal.fitx";
+    CSpreadsheet sheet;
+    for(int row = 1; row <= rows; ++row){
+        sheet.setCell(CPos(1, row), std::to_string(row));
+        sheet.setCell(CPos(2, row), "=A" + std::to_string(row) + "*2");
+    }
+    double saving = measure([&]{
+        for(int i = 0; i < saves; ++i){
+            sheet.setCell(CPos(3, i + 1), std::to_string(i));
+            sheet.save(filename, CFileFormat::Binary);
+        }
+    });
+    report("save after every edit", saves, "edits", saving);
+    sheet.openJournal(filename);
+    double journaling = measure([&]{
+        for(int i = 0; i < edits; ++i)
+            sheet.setCell(CPos(3, i + 1), std::to_string(i + 1));
+    });
+    report("journal every edit", edits, "edits", journaling);
+    sheet.closeJournal();
+    CSpreadsheet recovered;
+    double recovering = measure([&]{ recovered.openJournal(filename); });
+    recovered.closeJournal();
+    std::cout << "recovery from the checkpoint and " << edits << " records: " << recovering * 1e3 << " ms" << std::endl;
+    std::remove(filename.c_str());
+    std::remove((filename + ".journal").c_str());
+}
+
+int main(){
+    benchmarkEvaluation();
+    benchmarkParsing();
+    benchmarkImport();
+    benchmarkBatch();
+    benchmarkFormulaCache();
+    benchmarkLookup();
+    benchmarkFillDown();
+    benchmarkStrings();
+    benchmarkConcatenation();
+    benchmarkSheetLifetime();
+    benchmarkSparseCopy();
+    benchmarkFileFormats();
+    benchmarkLazyLoad();
+    benchmarkPipelinedLoad();
+    benchmarkJournal();
+    return 0;
+}
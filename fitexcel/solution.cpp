@@ -33,8 +33,14 @@
 #include <charconv>
 #include <span>
 #include <utility>
+#include <filesystem>
 //#include "expression.h"
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "CSpreadsheet.h"
+#include "CCrc32c.h"
+#include "CLz.h"
 
 using namespace std::literals;
 using CValue = std::variant<std::monostate, double, std::string>;
@@ -74,6 +80,16 @@ bool valueMatch(const CValue &r,
     //return fabs(std::get<double>(r) - std::get<double>(s)) <= 1e8 * DBL_EPSILON * fabs(std::get<double>(r));
 }
 
+//the number of bytes allocated on the heap, 0 where it is not known
+size_t allocatedSize(){
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
 int main() {
     CSpreadsheet x0, x1;
     std::ostringstream oss;
@@ -116,7 +132,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -179,7 +195,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -239,7 +255,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -290,6 +306,22 @@ int main() {
     assert(x0.setCell(CPos("Z6"), "=Z5-6"));
     assert(valueMatch(x0.getValue(CPos("Z5")), CValue()));
     assert(valueMatch(x0.getValue(CPos("Z6")), CValue()));
+    assert(x0.inCycle(CPos("Z4")) && x0.inCycle(CPos("Z5")) && x0.inCycle(CPos("Z6")) && !x0.inCycle(CPos("Z0")));
+    assert((x0.cyclicCells() == std::vector<CPos>{CPos("Z4"), CPos("Z5"), CPos("Z6")}));
+    assert(x0.setCell(CPos("Z6"), "=6"));
+    assert(valueMatch(x0.getValue(CPos("Z5")), CValue(26.0)));
+    assert(x0.setCell(CPos("Z3"), "=Z7+Z7"));
+    assert(x0.setCell(CPos("Z7"), "512"));
+    assert(valueMatch(x0.getValue(CPos("Z0")), CValue(2048.0)));
+    assert(x0.setCell(CPos("Z7"), "=Z0"));
+    assert(valueMatch(x0.getValue(CPos("Z0")), CValue()));
+    assert(x0.inCycle(CPos("Z0")) && x0.inCycle(CPos("Z3")) && x0.inCycle(CPos("Z7")) && !x0.inCycle(CPos("Z5")));
+    assert(valueMatch(x0.getValue(CPos("Z5")), CValue(26.0)));
+    assert(x0.setCell(CPos("Z3"), "1024"));
+    assert(valueMatch(x0.getValue(CPos("Z0")), CValue(2048.0)));
+    assert(!x0.inCycle(CPos("Z0")) && !x0.inCycle(CPos("Z7")) && !x0.inCycle(CPos("Z5")));
+    assert(x0.setCell(CPos("Z6"), "=Z5-6"));
+    assert(valueMatch(x0.getValue(CPos("Z5")), CValue()));
 
     for(int i = 0; i < 40; ++i){
         oss.clear();
@@ -323,7 +355,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -340,7 +372,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -364,7 +396,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -410,7 +442,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -490,7 +522,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -513,6 +545,20 @@ int main() {
 
 
 
+    assert (x0.setCell(CPos("AC1"), "=2^10*3"));
+    assert (x0.setCell(CPos("AC2"), "=(AC1-0)*1+0"));
+    assert (x0.setCell(CPos("AC3"), "=A6*1"));
+    assert (x0.setCell(CPos("AC4"), "=\"ab\"+\"cd\"+1/3"));
+    assert (x0.setCell(CPos("AC5"), "=1/3+AC1^2-1/0"));
+    assert (x0.setCell(CPos("AC6"), "=AC1^2+-(2)"));
+    assert (x0.cells().at(CPos("AC1")).reconstruct() == "3072");
+    assert (x0.cells().at(CPos("AC2")).reconstruct() == "AC1-0");
+    assert (valueMatch(x0.getValue(CPos("AC2")), CValue(3072.0)));
+    assert (valueMatch(x0.getValue(CPos("AC3")), CValue()));
+    assert (valueMatch(x0.getValue(CPos("AC4")), CValue()));
+    assert (valueMatch(x0.getValue(CPos("AC5")), CValue()));
+    assert (valueMatch(x0.getValue(CPos("AC6")), CValue(3072.0 * 3072.0 - 2)));
+
     assert(getString(26) == "Z");
     assert(getString(27) == "AA");
     assert(getString(28) == "AB");
@@ -554,7 +600,7 @@ int main() {
     iss.clear();
     iss.str(data);
     assert (x1.load(iss));
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -587,7 +633,7 @@ int main() {
     assert(x0.save("savefile.txt"));
     assert(x1.load("savefile.txt"));
 
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -598,7 +644,7 @@ int main() {
     x1 = CSpreadsheet();
     assert(x1.load("savefile.txt"));
 
-    for(auto& cell : x0.cells()){
+    for([[maybe_unused]] auto& cell : x0.cells()){
         assert (valueMatch(x0.getValue(cell.first), x1.getValue(cell.first)));
     }
 
@@ -607,7 +653,599 @@ int main() {
     assert(x0.load("savefile.txt"));
     assert(x0.cells().empty());
 
+    assert(x0.setCell(CPos("A1"), "1"));
+    for(int i = 2; i <= 100000; ++i)
+        assert(x0.setCell(CPos(1, i), "=A" + std::to_string(i - 1) + "+1"));
+    assert(valueMatch(x0.getValue(CPos(1, 100000)), CValue(100000.0)));
+    assert(x0.setCell(CPos("A1"), "=A100000"));
+    assert(x0.inCycle(CPos(1, 50000)));
+    x0.recalculate();
+    assert(valueMatch(x0.getValue(CPos(1, 50000)), CValue()));
+    assert(x0.setCell(CPos("A1"), "-1"));
+    x0.recalculate();
+    assert(valueMatch(x0.getValue(CPos(1, 50000)), CValue(49998.0)));
+
+    x0 = CSpreadsheet();
+    for(int i = 1; i <= 200; ++i){
+        assert(x0.setCell(CPos(1, i), std::to_string(i * 0.37)));
+        for(int j = 2; j <= 20; ++j)
+            assert(x0.setCell(CPos(j, i), "=" + getString(j - 1) + std::to_string(i) + "*1.01+$A" + std::to_string(i % 7 + 1)
+                                           + "/" + getString(j - 1) + "$1"));
+    }
+    assert(x0.setCell(CPos("C1"), "=D1"));
+    assert(x0.setCell(CPos("U1"), "=\"a\"+T1"));
+    x1 = x0;
+    x1.setThreadCount(4);
+    x0.recalculate();
+    x1.recalculate();
+    for([[maybe_unused]] auto& cell : x0.cells())
+        assert(x0.getValue(cell.first) == x1.getValue(cell.first));
+    assert(valueMatch(x1.getValue(CPos("D5")), CValue()));
+    assert(valueMatch(x1.getValue(CPos("B5")), x0.getValue(CPos("B5"))));
+    assert(x1.setCell(CPos("C1"), "=A1"));
+    assert(x0.setCell(CPos("C1"), "=A1"));
+    x1.recalculate();
+    for([[maybe_unused]] auto& cell : x0.cells())
+        assert(x0.getValue(cell.first) == x1.getValue(cell.first));
+
+    x0 = CSpreadsheet();
+    for(int i = 1; i <= 300; ++i)
+        assert(x0.setCell(CPos(1, i), std::to_string(i % 11 * 0.5)));
+    assert(x0.setCell(CPos("A50"), "x"));
+    assert(x0.setCell(CPos("B1"), "=10/A1+$A$2*A2-(A1<3)^2"));
+    assert(x0.setCell(CPos("C1"), "=C0+A1"));
+    for(int filled = 1; filled < 300; filled *= 2)
+        x0.copyRect(CPos(2, filled + 1), CPos("B1"), 2, std::min(filled, 300 - filled));
+    x1 = x0;
+    x0.recalculate();
+    for([[maybe_unused]] auto& cell : x0.cells())
+        assert(x0.getValue(cell.first) == x1.getValue(cell.first));
+    assert(valueMatch(x0.getValue(CPos("B11")), CValue()));
+    assert(valueMatch(x0.getValue(CPos("B49")), CValue()));
+    assert(valueMatch(x0.getValue(CPos("B3")), CValue(10 / 1.5 + 1.0 * 2.0 - 1)));
+    assert(x0.setCell(CPos("A3"), "4"));
+    x0.recalculate();
+    assert(valueMatch(x0.getValue(CPos("B3")), CValue(10 / 4.0 + 1.0 * 2.0)));
+
+    //a cell referenced only by the first cell of a run decides only that cell, a cell referenced by all of them all
+    x1 = CSpreadsheet();
+    for(int i = 1; i <= 20; ++i)
+        assert(x1.setCell(CPos(1, i), std::to_string(i)));
+    assert(x1.setCell(CPos("A1"), "x") && x1.setCell(CPos("C1"), "=A2*2") && x1.setCell(CPos("C2"), "y"));
+    assert(x1.setCell(CPos("B1"), "=A1+$C$1") && x1.setCell(CPos("D1"), "=A1+$C$2"));
+    for(int filled = 1; filled < 20; filled *= 2){
+        x1.copyRect(CPos(2, filled + 1), CPos("B1"), 1, std::min(filled, 20 - filled));
+        x1.copyRect(CPos(4, filled + 1), CPos("D1"), 1, std::min(filled, 20 - filled));
+    }
+    x1.recalculate();
+    assert(valueMatch(x1.getValue(CPos("B1")), CValue()) && valueMatch(x1.getValue(CPos("B20")), CValue(24.0)));
+    assert(valueMatch(x1.getValue(CPos("D1")), CValue("xy")) && valueMatch(x1.getValue(CPos("D20")), CValue()));
+
+    x1 = x0;
+    assert(x1.setCell(CPos("A3"), "5"));
+    assert(x1.setCell(CPos("A301"), "=A300"));
+    assert(x1.setCell(CPos("B5"), ""));
+    assert(valueMatch(x1.getValue(CPos("B3")), CValue(10 / 5.0 + 1.0 * 2.0)));
+    assert(valueMatch(x0.getValue(CPos("B3")), CValue(10 / 4.0 + 1.0 * 2.0)));
+    assert(valueMatch(x1.getValue(CPos("A301")), x0.getValue(CPos("A300"))));
+    assert(valueMatch(x0.getValue(CPos("A301")), CValue()));
+    assert(valueMatch(x1.getValue(CPos("B5")), CValue()) && !valueMatch(x0.getValue(CPos("B5")), CValue()));
+    assert(x0.cells().size() == x1.cells().size() && x0.cells().count(CPos("B5")) && !x1.cells().count(CPos("B5")));
+
+    CSpreadsheet x3;
+    assert(x3.setCell(CPos("A1"), "label"));
+    for(int row = 2; row <= 2000; ++row)
+        assert(x3.setCell(CPos(1, row), "=A" + std::to_string(row - 1) + "+\"xy\""));
+    std::string label = "label";
+    for(int row = 2; row <= 2000; ++row)
+        label += "xy";
+    assert(x3.setCell(CPos("B1"), label));
+    assert(x3.setCell(CPos("B2"), "=A2000=B1"));
+    assert(x3.setCell(CPos("B3"), "=A2000<A1999"));
+    assert(x3.setCell(CPos("B4"), "=A1999+\"z\"<A2000"));
+    x3.recalculate();
+    assert(valueMatch(x3.getValue(CPos("A2000")), CValue(label)));
+    assert(valueMatch(x3.getValue(CPos("B2")), CValue(1.0)));
+    assert(valueMatch(x3.getValue(CPos("B3")), CValue(0.0)));
+    assert(valueMatch(x3.getValue(CPos("B4")), CValue(0.0)));
+
+    CSpreadsheet x4;
+    assert(x4.setCell(CPos("A1"), "=-2^2+2^3^2"));
+    assert(x4.setCell(CPos("A2"), "=1=2<3"));
+    assert(x4.setCell(CPos("A3"), "=\"say \"\"hi\"\"\"+\"!\""));
+    assert(x4.setCell(CPos("A4"), "12.5e1\t"));
+    assert(x4.setCell(CPos("A5"), " 12"));
+    assert(x4.setCell(CPos("A6"), "=A$01*2--A4"));
+    assert(!x4.setCell(CPos("A7"), "=1+"));
+    assert(!x4.setCell(CPos("A7"), "=A01"));
+    assert(!x4.setCell(CPos("A7"), "=A1B"));
+    assert(!x4.setCell(CPos("A7"), "=2^-2"));
+    assert(!x4.setCell(CPos("A7"), "=\"abc"));
+    assert(!x4.setCell(CPos("A7"), "=" + std::string(5000, '(') + "1" + std::string(5000, ')')));
+    assert(valueMatch(x4.getValue(CPos("A1")), CValue(60.0)));
+    assert(valueMatch(x4.getValue(CPos("A2")), CValue(1.0)));
+    assert(valueMatch(x4.getValue(CPos("A3")), CValue("say \"hi\"!"s)));
+    assert(valueMatch(x4.getValue(CPos("A4")), CValue(125.0)));
+    assert(valueMatch(x4.getValue(CPos("A5")), CValue(" 12"s)));
+    assert(valueMatch(x4.getValue(CPos("A6")), CValue(245.0)));
+    assert(valueMatch(x4.getValue(CPos("A7")), CValue()));
+    assert(!x4.cells().at(CPos("A4")).formula && x4.cells().at(CPos("A4")).reconstruct() == "125");
+    assert(x4.setCell(CPos("A8"), "a \"quote\""));
+    assert(!x4.cells().at(CPos("A8")).formula && x4.cells().at(CPos("A8")).reconstruct() == "\"a \"\"quote\"\"\"");
+    x4.copyRect(CPos("B8"), CPos("A8"));
+    assert(valueMatch(x4.getValue(CPos("B8")), CValue("a \"quote\""s)));
+
+    std::vector<std::pair<CPos, std::string>> batch;
+    for(int row = 1; row <= 1000; ++row){
+        batch.emplace_back(CPos(1, row), std::to_string(row));
+        batch.emplace_back(CPos(2, row), "=A" + std::to_string(row) + "*2+B" + std::to_string(row + 1));
+    }
+    batch.emplace_back(CPos("B1001"), "=C1+1");
+    batch.emplace_back(CPos("C1"), "=B1");
+    batch.emplace_back(CPos("C2"), "=1+");
+    batch.emplace_back(CPos("A1"), "5");
+    for(unsigned threads : {1u, 4u}){
+        CSpreadsheet x5, x6;
+        assert(x5.setCell(CPos("C2"), "text"));
+        assert(x6.setCell(CPos("C2"), "text"));
+        x5.setThreadCount(threads);
+        std::vector<std::string> errors = x5.setCells(batch);
+        assert(errors.size() == batch.size());
+        for(size_t i = 0; i < batch.size(); ++i){
+            assert(errors[i].empty() == (batch[i].second != "=1+"));
+            if(errors[i].empty())
+                assert(x6.setCell(batch[i].first, batch[i].second));
+        }
+        assert(x5.inCycle(CPos("B1")) && x5.inCycle(CPos("C1")) && x5.inCycle(CPos("B1001")));
+        assert(x5.cyclicCells().size() == x6.cyclicCells().size());
+        x5.recalculate();
+        for([[maybe_unused]] auto& cell : x6.cells())
+            assert(x5.getValue(cell.first) == x6.getValue(cell.first));
+        assert(valueMatch(x5.getValue(CPos("C2")), CValue("text"s)));
+        assert(valueMatch(x5.getValue(CPos("B1")), CValue()));
+    }
+
+    CSpreadsheet x7;
+    x7.setFormulaCacheCapacity(2);
+    assert(x7.setCell(CPos("A1"), "10"));
+    for(int row = 1; row <= 100; ++row)
+        assert(x7.setCell(CPos(2, row), "=$A$1*0.21"));
+    assert(x7.formulaCache().misses() == 1 && x7.formulaCache().hits() == 99 && x7.formulaCache().size() == 1);
+    assert(x7.cells().at(CPos("B1")).formula == x7.cells().at(CPos("B100")).formula);
+    assert(!x7.setCell(CPos("C1"), "=1+") && x7.formulaCache().size() == 1);
+    assert(x7.setCell(CPos("C1"), "=A1+1") && x7.setCell(CPos("C2"), "=A1+2") && x7.formulaCache().size() == 2);
+    assert(x7.setCell(CPos("C3"), "=$A$1*0.21") && x7.formulaCache().misses() == 5);
+    std::vector<std::pair<CPos, std::string>> repeated;
+    for(int row = 1; row <= 10; ++row)
+        repeated.emplace_back(CPos(4, row), row % 2 ? "=A1+2" : "=A1*3");
+    x7.setCells(repeated);
+    assert(x7.formulaCache().hits() == 104 && x7.formulaCache().misses() == 6);
+    assert(valueMatch(x7.getValue(CPos("B50")), CValue(2.1)) && valueMatch(x7.getValue(CPos("D2")), CValue(30.0)));
+
+    CSpreadsheet x8;
+    assert(x8.setCell(CPos("A1"), "3") && x8.setCell(CPos("A2"), "say \"hi\" | twice"));
+    assert(x8.setCell(CPos("B1"), "=A1*$A$1+0.1") && x8.setCell(CPos("C1"), "=A2+\"!\"") && x8.setCell(CPos("D1"), "=-A1^2<>E1"));
+    assert(x8.setCell(CPos("E1"), "=D1") && x8.setCell(CPos("F1"), "=F2") && x8.setCell(CPos("F2"), "=F1"));
+    x8.copyRect(CPos("B2"), CPos("B1"), 1, 1);
+    x8.copyRect(CPos("B3"), CPos("B1"), 1, 2);
+    oss.clear();
+    oss.str("");
+    assert(x8.save(oss, CFileFormat::Binary));
+    data = oss.str();
+    assert(data.compare(0, 4, "FITX") == 0);
+    iss.clear();
+    iss.str(data);
+    CSpreadsheet x9;
+    assert(x9.load(iss));
+    assert(x9.cells().size() == x8.cells().size());
+    for([[maybe_unused]] const auto& cell : x8.cells())
+        assert(x9.cells().at(cell.first).reconstruct() == cell.second.reconstruct());
+    assert(x9.cells().at(CPos("B1")).formula == x9.cells().at(CPos("B4")).formula);
+    assert(valueMatch(x9.getValue(CPos("B1")), CValue(9.1)) && valueMatch(x9.getValue(CPos("C1")), CValue("say \"hi\" | twice!"s)));
+    assert(x9.inCycle(CPos("D1")) && x9.inCycle(CPos("F2")) && !x9.inCycle(CPos("B1")));
+    assert(x9.save("savefile.txt", CFileFormat::Binary) && x7.load("savefile.txt"));
+    assert(valueMatch(x7.getValue(CPos("B2")), CValue()) && valueMatch(x7.getValue(CPos("A2")), CValue("say \"hi\" | twice"s)));
+    for(size_t length = 0; length < data.size(); ++length){
+        iss.clear();
+        iss.str(data.substr(0, length));
+        assert(!x9.load(iss));
+    }
+    iss.clear();
+    iss.str(data + "x");
+    assert(!x9.load(iss));
+    data[4] = 4;
+    iss.clear();
+    iss.str(data);
+    assert(!x9.load(iss));
+    assert(valueMatch(x9.getValue(CPos("B1")), CValue(9.1)) && x9.inCycle(CPos("F1")));
 
+    assert(CCrc32c::of("123456789") == 0xe3069283);
+    oss.clear();
+    oss.str("");
+    assert(x8.save(oss));
+    data = oss.str();
+    assert(data.compare(0, 12, "#FITEXCEL 2|") == 0);
+    iss.clear();
+    iss.str(data);
+    assert(x9.load(iss) && valueMatch(x9.getValue(CPos("A2")), CValue("say \"hi\" | twice"s)));
+    for(size_t i = 12; i < data.size(); i += 7){
+        std::string damaged = data;
+        damaged[i] ^= 0x01;
+        iss.clear();
+        iss.str(damaged);
+        assert(!x9.load(iss));
+    }
+    iss.clear();
+    iss.str(data.substr(0, data.rfind('#')));
+    assert(!x9.load(iss));
+    CSpreadsheet x10;
+    assert(x10.setCell(CPos("A1"), "1"));
+    for(int row = 2; row <= 5000; ++row)
+        assert(x10.setCell(CPos(1, row), "=A" + std::to_string(row - 1) + "+1"));
+    for([[maybe_unused]] CFileFormat format : {CFileFormat::Text, CFileFormat::Binary, CFileFormat::Compressed}){
+        oss.clear();
+        oss.str("");
+        assert(x10.save(oss, format));
+        data = oss.str();
+        iss.clear();
+        iss.str(data);
+        assert(x9.load(iss) && valueMatch(x9.getValue(CPos("A4999")), CValue(4999.0)));
+        data[data.size() / 2] ^= 0x10;
+        iss.clear();
+        iss.str(data);
+        assert(!x9.load(iss) && valueMatch(x9.getValue(CPos("A4999")), CValue(4999.0)));
+    }
+    //files of older versions are still loaded
+    iss.clear();
+    iss.str("1 1 =5|2 1 =A1*2|0 0 " + std::to_string(std::hash<std::string>{}("=511=A1*221")) + "|");
+    assert(x9.load(iss) && valueMatch(x9.getValue(CPos("B1")), CValue(10.0)) && x9.cells().size() == 2);
+    iss.clear();
+    iss.str("FITX\x01\0\0\0\0\0\0\0\x01\0\0\0\0\0\0\0\x01\0\0\0\x01\0\0\0\0\0\0\0\0\0\0\x04\x40"s);
+    assert(x9.load(iss) && valueMatch(x9.getValue(CPos("A1")), CValue(2.5)) && x9.cells().size() == 1);
+
+    CSpreadsheet x11(std::move(x10));
+    assert(x10.cells().empty() && valueMatch(x10.getValue(CPos("A5000")), CValue()));
+    assert(valueMatch(x11.getValue(CPos("A5000")), CValue(5000.0)) && x11.cells().size() == 5000);
+    assert(x10.setCell(CPos("A1"), "=A2") && x10.setCell(CPos("A2"), "=A1") && x10.inCycle(CPos("A1")));
+    x11 = std::move(x10);
+    assert(x11.inCycle(CPos("A2")) && x11.cells().size() == 2 && valueMatch(x11.getValue(CPos("A1")), CValue()));
+    assert(!x10.inCycle(CPos("A2")) && x10.cyclicCells().empty() && x10.cells().empty());
+    assert(x10.setCell(CPos("B1"), "7") && x10.setCell(CPos("B2"), "=B1*2") && valueMatch(x10.getValue(CPos("B2")), CValue(14.0)));
+
+    CSpreadsheet x12, x13;
+    assert(x12.setCell(CPos("A1"), "1"));
+    for(int row = 2; row <= 300; ++row)
+        assert(x12.setCell(CPos(1, row), "=A" + std::to_string(row - 1) + "+1"));
+    assert(x12.setCell(CPos("B1"), "=CZ300") && x12.setCell(CPos("CZ300"), "=B1") && x12.setCell(CPos("CA1"), "far"));
+    assert(x12.save("lazyfile.bin", CFileFormat::Binary) && x13.load("lazyfile.bin", CLoadMode::Lazy));
+    assert(valueMatch(x13.getValue(CPos("A200")), CValue(200.0)) && valueMatch(x13.getValue(CPos("CA1")), CValue("far"s)));
+    assert(x13.inCycle(CPos("B1")) && x13.inCycle(CPos("CZ300")) && !x13.inCycle(CPos("A300")));
+    assert(x13.setCell(CPos("A100"), "0") && valueMatch(x13.getValue(CPos("A300")), CValue(200.0)));
+    x13.copyRect(CPos("CB1"), CPos("CA1"));
+    assert(valueMatch(x13.getValue(CPos("CB1")), CValue("far"s)) && x13.cells().size() == x12.cells().size() + 1);
+    CSpreadsheet x14(x13);
+    assert(x14.load("lazyfile.bin", CLoadMode::Lazy));
+    x13 = x14;
+    x14.materialize();
+    assert(x14.cells().size() == x12.cells().size() && valueMatch(x13.getValue(CPos("A300")), CValue(300.0)));
+    std::ifstream lazy_ifs("lazyfile.bin", std::ios::binary);
+    data.assign(std::istreambuf_iterator<char>(lazy_ifs), std::istreambuf_iterator<char>());
+    lazy_ifs.close();
+    data[data.size() / 2] ^= 0x10;
+    std::ofstream("lazyfile.bin", std::ios::binary) << data;
+    assert(x14.load("lazyfile.bin", CLoadMode::Lazy));
+    [[maybe_unused]] bool damaged = false;
+    try{
+        x14.materialize();
+    }
+    catch(std::runtime_error&){
+        damaged = true;
+    }
+    assert(damaged);
+    //a copy shares the lazily loaded file, a tile of it is not decoded once the file was overwritten
+    assert(x12.save("lazyfile.bin", CFileFormat::Binary) && x14.load("lazyfile.bin", CLoadMode::Lazy));
+    CSpreadsheet lazy_copy(x14);
+    assert(x14.save("lazyfile.bin") && valueMatch(x14.getValue(CPos("A300")), CValue(300.0)));
+    damaged = false;
+    try{
+        lazy_copy.getValue(CPos("A300"));
+    }
+    catch(std::runtime_error&){
+        damaged = true;
+    }
+    assert(damaged);
+    //files without an index are loaded eagerly
+    assert(x12.save("lazyfile.bin") && x14.load("lazyfile.bin", CLoadMode::Lazy));
+    assert(x14.cells().size() == x12.cells().size() && x14.inCycle(CPos("B1")));
+    std::remove("lazyfile.bin");
+
+    auto fileSize = [](const std::string& filename){
+        return (long long)std::ifstream(filename, std::ios::binary | std::ios::ate).tellg();
+    };
+    std::remove("journal.fitx");
+    std::remove("journal.fitx.journal");
+    CSpreadsheet x15, x16;
+    assert(x15.setCell(CPos("A1"), "2") && x15.openJournal("journal.fitx") && x15.cells().size() == 1);
+    [[maybe_unused]] long long checkpoint_size = fileSize("journal.fitx");
+    [[maybe_unused]] long long journal_size = fileSize("journal.fitx.journal");
+    assert(x15.setCell(CPos("B1"), "=A1*10") && !x15.setCell(CPos("B2"), "=1+"));
+    assert(fileSize("journal.fitx") == checkpoint_size && fileSize("journal.fitx.journal") - journal_size < 40);
+    x15.copyRect(CPos("C1"), CPos("B1"));
+    x15.setCells(std::vector<std::pair<CPos, std::string>>{{CPos("B1"), "=A1*100"}, {CPos("D1"), "=C1+"}, {CPos("E1"), "x"}});
+    x15.closeJournal();
+    assert(x16.openJournal("journal.fitx") && x16.cells().size() == 4);
+    assert(valueMatch(x16.getValue(CPos("B1")), CValue(200.0)) && valueMatch(x16.getValue(CPos("C1")), CValue(2000.0)));
+    assert(valueMatch(x16.getValue(CPos("E1")), CValue("x"s)) && x16.cells().at(CPos("C1")).reconstruct() == "B1*10");
+    //a record torn by a crash is dropped and the next one is appended in its place
+    journal_size = fileSize("journal.fitx.journal");
+    assert(x16.setCell(CPos("F1"), "torn"));
+    x16.closeJournal();
+    std::filesystem::resize_file("journal.fitx.journal", fileSize("journal.fitx.journal") - 3);
+    assert(x15.openJournal("journal.fitx") && !x15.cells().find(CPos("F1")) && fileSize("journal.fitx.journal") == journal_size);
+    assert(x15.setCell(CPos("F2"), "=A1+1"));
+    assert(x16.openJournal("journal.fitx") && valueMatch(x16.getValue(CPos("F2")), CValue(3.0)) && x16.cells().size() == 5);
+    //a journal larger than the checkpoint is compacted into a new one
+    assert(x16.openJournal("journal.fitx", 0));
+    for(int row = 1; row <= 200; ++row)
+        assert(x16.setCell(CPos(7, row), std::to_string(row)));
+    assert(fileSize("journal.fitx.journal") < fileSize("journal.fitx") && fileSize("journal.fitx") > checkpoint_size);
+    assert(x15.openJournal("journal.fitx") && x15.cells().size() == 205 && valueMatch(x15.getValue(CPos("G200")), CValue(200.0)));
+    //a journal left from an interrupted compaction does not belong to the checkpoint and is ignored
+    assert(x15.setCell(CPos("A1"), "3") && x15.setCell(CPos("H1"), "=A1") && x8.save("journal.fitx", CFileFormat::Binary));
+    assert(x16.openJournal("journal.fitx") && x16.cells().size() == x8.cells().size() && !x16.cells().find(CPos("H1")));
+    //a load or an assignment replaces the checkpoint
+    x16 = x12;
+    assert(x16.setCell(CPos("A1"), "5"));
+    x16.closeJournal();
+    assert(x15.openJournal("journal.fitx") && valueMatch(x15.getValue(CPos("A300")), CValue(304.0)));
+    //a copy that does nothing is not recorded, so the journal can still be opened
+    journal_size = fileSize("journal.fitx.journal");
+    x15.copyRect(CPos("B1"), CPos("A1"), -1, 1);
+    assert(fileSize("journal.fitx.journal") == journal_size);
+    x15.closeJournal();
+    assert(x16.openJournal("journal.fitx") && valueMatch(x16.getValue(CPos("A300")), CValue(304.0)));
+    //a move assignment replaces the checkpoint too, a spreadsheet moved from stops keeping its journal
+    x16 = CSpreadsheet();
+    assert(x16.setCell(CPos("A1"), "6"));
+    CSpreadsheet moved(std::move(x16));
+    assert(moved.setCell(CPos("A2"), "7") && x16.setCell(CPos("A3"), "8"));
+    assert(x15.openJournal("journal.fitx") && x15.cells().size() == 1 && valueMatch(x15.getValue(CPos("A1")), CValue(6.0)));
+    //a load whose checkpoint cannot be written fails and leaves the spreadsheet unchanged
+    std::filesystem::create_directory("journal.fitx.tmp");
+    oss.clear();
+    oss.str("");
+    assert(x12.save(oss));
+    iss.clear();
+    iss.str(oss.str());
+    assert(!x15.load(iss) && x15.cells().size() == 1 && valueMatch(x15.getValue(CPos("A1")), CValue(6.0)));
+    std::filesystem::remove("journal.fitx.tmp");
+    assert(x15.setCell(CPos("A2"), "7"));
+    x15.closeJournal();
+    assert(x16.openJournal("journal.fitx") && x16.cells().size() == 2);
+    x16.closeJournal();
+    //a journal that cannot be opened leaves the one kept before, a checkpoint that cannot be read is not replaced
+    std::filesystem::create_directory("damaged.fitx");
+    assert(x15.openJournal("journal.fitx") && !x15.openJournal("damaged.fitx") && std::filesystem::is_directory("damaged.fitx"));
+    assert(x15.setCell(CPos("A3"), "8"));
+    x15.closeJournal();
+    assert(x16.openJournal("journal.fitx") && x16.cells().size() == 3);
+    x16.closeJournal();
+    std::filesystem::remove("damaged.fitx");
+    std::remove("journal.fitx");
+    std::remove("journal.fitx.journal");
+
+    //the pipelined load of a text file gives the same spreadsheet as the sequential one and rejects the same files
+    CSpreadsheet x17, x18, x19;
+    std::vector<std::pair<CPos, std::string>> rows;
+    for(int row = 1; row <= 10000; ++row){
+        rows.emplace_back(CPos(1, row), row % 3 ? std::to_string(row) : "a \"|\" b|" + std::to_string(row));
+        rows.emplace_back(CPos(2, row), "=A" + std::to_string(row) + "+B" + std::to_string(row % 100 + 1));
+    }
+    x17.setCells(rows);
+    oss.clear();
+    oss.str("");
+    assert(x17.save(oss));
+    data = oss.str();
+    assert(data.size() > 4 * 64 * 1024);
+    x18.setThreadCount(4);
+    iss.clear();
+    iss.str(data);
+    assert(x18.load(iss) && x18.cells().size() == x17.cells().size());
+    for([[maybe_unused]] const auto& cell : x17.cells())
+        assert(x18.cells().at(cell.first).reconstruct() == cell.second.reconstruct());
+    assert(x18.inCycle(CPos("B1")) && valueMatch(x18.getValue(CPos("A3")), CValue("a \"|\" b|3"s)));
+    assert(x18.cyclicCells() == x17.cyclicCells());
+    x19.setThreadCount(3);
+    assert(x19.setCell(CPos("A1"), "kept"));
+    for(size_t i = 12; i < data.size(); i += data.size() / 17){
+        std::string damaged = data;
+        damaged[i] ^= 0x04;
+        iss.clear();
+        iss.str(damaged);
+        assert(!x19.load(iss));
+        iss.clear();
+        iss.str(data.substr(0, i));
+        assert(!x19.load(iss));
+    }
+    iss.clear();
+    iss.str(data + "1 1 =2|");
+    assert(!x19.load(iss) && x19.cells().size() == 1 && valueMatch(x19.getValue(CPos("A1")), CValue("kept"s)));
+
+    //expressions are saved with the shortest numbers and only the parentheses the parser needs
+    CSpreadsheet x20;
+    std::vector<std::pair<std::string, std::string>> expressions = {
+        {"=A1-(B1-C1)", "A1-(B1-C1)"}, {"=(A1-B1)-C1", "A1-B1-C1"}, {"=-A1^B1", "-A1^B1"}, {"=(-A1)^B1", "(-A1)^B1"},
+        {"=A1^(-2)", "A1^(-2)"}, {"=A1^(B1^C1)", "A1^(B1^C1)"}, {"=(A1=B1)<>(C1<D1)", "A1=B1<>C1<D1"},
+        {"=$A1*0.1+-(A$1/3e300)", "$A1*0.1+-(A$1/3e+300)"}, {"=A1-1e400", "A1-1e999"}, {"=(\"a\"\"|\"+A1)*2", "(\"a\"\"|\"+A1)*2"}
+    };
+    for(size_t i = 0; i < expressions.size(); ++i)
+        assert(x20.setCell(CPos(5, (int)i + 1), expressions[i].first)
+               && x20.cells().at(CPos(5, (int)i + 1)).reconstruct() == expressions[i].second);
+    assert(x20.setCell(CPos("A1"), "2") && x20.setCell(CPos("B1"), "3") && x20.setCell(CPos("C1"), "-0.5"));
+    oss.clear();
+    oss.str("");
+    assert(x20.save(oss));
+    iss.clear();
+    iss.str(oss.str());
+    assert(x19.load(iss) && x19.cells().size() == x20.cells().size());
+    for([[maybe_unused]] const auto& cell : x20.cells()){
+        assert(x19.cells().at(cell.first).reconstruct() == cell.second.reconstruct());
+        assert(valueMatch(x19.getValue(cell.first), x20.getValue(cell.first)));
+    }
+    assert(valueMatch(x19.getValue(CPos("E5")), CValue(0.25)) && valueMatch(x19.getValue(CPos("E1")), CValue(-1.5)));
+
+    std::string run(100000, 'a'), noise, compressed, decompressed;
+    lzCompress(run, compressed);
+    assert(compressed.size() < 1000 && lzDecompress(compressed, run.size(), decompressed) && decompressed == run);
+    for(int i = 0; i < 10000; ++i)
+        noise.push_back((char)((i * 7919 % 251) ^ (i >> 3)));
+    compressed.clear();
+    lzCompress(noise, compressed);
+    assert(lzDecompress(compressed, noise.size(), decompressed) && decompressed == noise);
+    assert(!lzDecompress(compressed, noise.size() + 1, decompressed));
+    assert(!lzDecompress(std::string_view(compressed).substr(0, compressed.size() / 2), noise.size(), decompressed));
+    compressed.clear();
+    lzCompress("", compressed);
+    assert(lzDecompress(compressed, 0, decompressed) && decompressed.empty());
+    CSpreadsheet x21;
+    assert(x21.setCell(CPos("A1"), "-0") && x21.setCell(CPos("A2"), "-7") && x21.setCell(CPos("A3"), "0.1"));
+    assert(x21.setCell(CPos("A4"), "9007199254740993") && x21.setCell(CPos("A5"), "1e300") && x21.setCell(CPos("A6"), "=A7"));
+    x21.copyRect(CPos(INT_MAX - 5, 5), CPos("A6"), 1, 1);
+    x21.copyRect(CPos(INT_MIN + 5, 3), CPos("A6"), 1, 1);
+    for(CSpreadsheet* source : {&x8, &x12, &x20, &x21}){
+        oss.clear();
+        oss.str("");
+        assert(source->save(oss, CFileFormat::Compressed));
+        data = oss.str();
+        assert(data.compare(0, 4, "FITZ") == 0);
+        iss.clear();
+        iss.str(data);
+        assert(x19.load(iss) && x19.cells().size() == source->cells().size());
+        for([[maybe_unused]] const auto& cell : source->cells()){
+            assert(x19.cells().at(cell.first).reconstruct() == cell.second.reconstruct());
+            assert(valueMatch(x19.getValue(cell.first), source->getValue(cell.first)));
+        }
+    }
+    assert(std::signbit(std::get<double>(x19.getValue(CPos("A1")))) && valueMatch(x19.getValue(CPos("A4")), CValue(9007199254740992.0)));
+    //cells sharing a formula share it again, so do cells whose formulas refer to the same cells relative to them
+    oss.clear();
+    oss.str("");
+    assert(x8.save(oss, CFileFormat::Compressed));
+    data = oss.str();
+    iss.clear();
+    iss.str(data);
+    assert(x19.load(iss) && x19.cells().at(CPos("B1")).formula == x19.cells().at(CPos("B4")).formula);
+    assert(x19.inCycle(CPos("D1")) && valueMatch(x19.getValue(CPos("B1")), CValue(9.1)));
+    for(size_t length = 0; length < data.size(); ++length){
+        iss.clear();
+        iss.str(data.substr(0, length));
+        assert(!x19.load(iss));
+    }
+    for(size_t i = 8; i < data.size(); ++i){
+        std::string damaged = data;
+        damaged[i] ^= 0x04;
+        iss.clear();
+        iss.str(damaged);
+        assert(!x19.load(iss));
+    }
+    iss.clear();
+    iss.str(data + "x");
+    assert(!x19.load(iss) && x19.inCycle(CPos("D1")));
+    [[maybe_unused]] size_t sizes[3];
+    for(CFileFormat format : {CFileFormat::Text, CFileFormat::Binary, CFileFormat::Compressed}){
+        oss.clear();
+        oss.str("");
+        assert(x12.save(oss, format));
+        sizes[(int)format] = oss.str().size();
+    }
+    assert(sizes[2] * 10 < sizes[0] && sizes[2] * 10 < sizes[1]);
+    //a lazy load of a compressed file loads it eagerly
+    assert(x12.save("lazyfile.bin", CFileFormat::Compressed) && x19.load("lazyfile.bin", CLoadMode::Lazy));
+    assert(x19.cells().size() == x12.cells().size() && valueMatch(x19.getValue(CPos("A300")), CValue(300.0)));
+    assert(x19.cells().at(CPos("A2")).formula == x19.cells().at(CPos("A300")).formula);
+    assert(x19.cells().at(CPos("A300")).reconstruct() == "A299+1");
+    std::remove("lazyfile.bin");
+
+    //an empty rectangle copies nothing
+    x19.copyRect(CPos("B1"), CPos("A300"), -1, 1);
+    x19.copyRect(CPos("B1"), CPos("A300"), 1, 0);
+    assert(x19.cells().size() == x12.cells().size() && x19.cells().at(CPos("B1")).reconstruct() == "CZ300");
+
+    //the nodes of overwritten formulas and of formulas that failed to parse are released
+    CSpreadsheet x22;
+    x22.setFormulaCacheCapacity(0);
+    [[maybe_unused]] size_t allocated = allocatedSize();
+    for(int i = 0; i < 50000; ++i){
+        assert(x22.setCell(CPos("A1"), "=B" + std::to_string(i + 1) + "*" + std::to_string(i) + "+\"x\""));
+        assert(!x22.setCell(CPos("A2"), "=B" + std::to_string(i + 1) + "*" + std::to_string(i) + "+"));
+    }
+    assert(x22.cells().size() == 1 && x22.cells().at(CPos("A1")).reconstruct() == "B50000*49999+\"x\"");
+    assert(allocatedSize() < allocated + 1024 * 1024);
+    //formulas built one after another share arenas, an arena is released with the last of its formulas
+    allocated = allocatedSize();
+    for(int i = 1; i <= 20000; ++i)
+        assert(x22.setCell(CPos(2, i), "=A" + std::to_string(i) + "+" + std::to_string(i)));
+    for(int i = 1; i <= 20000; ++i)
+        assert(x22.setCell(CPos(2, i), ""));
+    assert(x22.cells().size() == 1 && allocatedSize() < allocated + 1024 * 1024);
+
+    //a tile maps all its offsets to its cells only while it is dense, erasing moves the last cell of the tile
+    CGrid<int> grid;
+    const int tile_cells = CGrid<int>::TILE_SIZE * CGrid<int>::TILE_SIZE;
+    auto tilePos = [](int i){
+        return CPos(CGrid<int>::TILE_SIZE + i / CGrid<int>::TILE_SIZE, CGrid<int>::TILE_SIZE + i % CGrid<int>::TILE_SIZE);
+    };
+    for(int i = 0; i < tile_cells; ++i)
+        grid[tilePos(i)] = i;
+    for(int i = 0; i < tile_cells - 10; ++i)
+        assert(grid.erase(tilePos(i)) && !grid.erase(tilePos(i)));
+    assert(grid.size() == 10 && !grid.find(tilePos(0)) && grid.at(tilePos(tile_cells - 1)) == tile_cells - 1);
+    for(int i = 0; i < tile_cells; ++i)
+        assert(grid.count(tilePos(i)) == (i >= tile_cells - 10) && (i < tile_cells - 10 || grid.at(tilePos(i)) == i));
+
+    //cells scattered one per tile take little memory
+    CSpreadsheet x23;
+    assert(x23.setCell(CPos("B1"), "0"));
+    allocated = allocatedSize();
+    for(int row = 1; row <= 20000; ++row)
+        assert(x23.setCell(CPos(1, row * CGrid<CCell>::TILE_SIZE), "=" + std::to_string(row) + "+B1"));
+    x23.recalculate();
+    assert(valueMatch(x23.getValue(CPos(1, 20000 * CGrid<CCell>::TILE_SIZE)), CValue(20000.0)));
+    assert(allocatedSize() < allocated + 32 * 1024 * 1024);
+    //an edit of a copy of the sparse sheet copies only the paths to the tiles and cycles it touches
+    assert(x23.setCell(CPos("C1"), "=C2") && x23.setCell(CPos("C2"), "=C1"));
+    std::vector<CSpreadsheet> x23_copies;
+    x23_copies.reserve(100);
+    allocated = allocatedSize();
+    for(int i = 1; i <= 100; ++i){
+        x23_copies.push_back(x23);
+        assert(x23_copies.back().setCell(CPos(1, i * CGrid<CCell>::TILE_SIZE), "=B1-" + std::to_string(i)));
+        assert(x23_copies.back().setCell(CPos("C2"), std::to_string(i)));
+    }
+    assert(allocatedSize() < allocated + 8 * 1024 * 1024);
+    for(int i = 1; i <= 100; ++i){
+        assert(valueMatch(x23_copies[i - 1].getValue(CPos(1, i * CGrid<CCell>::TILE_SIZE)), CValue(-(double)i)));
+        assert(valueMatch(x23_copies[i - 1].getValue(CPos("C1")), CValue((double)i)));
+    }
+    assert(valueMatch(x23.getValue(CPos(1, 100 * CGrid<CCell>::TILE_SIZE)), CValue(100.0)));
+    assert(valueMatch(x23.getValue(CPos("C1")), CValue()));
+
+    //a compiled formula keeps numbers on a plain stack and continues with boxed values from the first value that is
+    //not a number, a formula deeper than the local stack allocates it
+    CSpreadsheet x24;
+    assert(x24.setCell(CPos("A1"), "2") && x24.setCell(CPos("D1"), "x"));
+    std::string deep = "A1", deep_string = "D1=\"x\"";
+    for(int i = 0; i < 40; ++i){
+        deep = "1+(" + deep + ")";
+        deep_string = "1+(" + deep_string + ")";
+    }
+    assert(x24.setCell(CPos("B1"), "=" + deep) && x24.setCell(CPos("B2"), "=" + deep_string));
+    assert(x24.setCell(CPos("C1"), "=(A1*2=4)+(\"x\"=D1)") && x24.setCell(CPos("C2"), "=(A1+1)*(D1=\"x\")"));
+    assert(x24.setCell(CPos("C3"), "=A1/(A1-2)+1") && x24.setCell(CPos("C4"), "=(A1+1)*2<\"a\"") && x24.setCell(CPos("C5"), "=A1+Z99"));
+    assert(valueMatch(x24.getValue(CPos("B1")), CValue(42.0)) && valueMatch(x24.getValue(CPos("B2")), CValue(41.0)));
+    assert(valueMatch(x24.getValue(CPos("C1")), CValue(2.0)) && valueMatch(x24.getValue(CPos("C2")), CValue(3.0)));
+    assert(valueMatch(x24.getValue(CPos("C3")), CValue()) && valueMatch(x24.getValue(CPos("C4")), CValue()));
+    assert(valueMatch(x24.getValue(CPos("C5")), CValue()));
 
     return EXIT_SUCCESS;
 }